@@ -1,5 +1,6 @@
 #include "carbon.h"
 
+#include "intern.h"
 #include "tr_malloc.h"
 
 #pragma clang diagnostic push
@@ -36,10 +37,19 @@ inline char *find_process_name_for_pid(pid_t pid) {
 	return find_process_name_for_psn(&psn);
 }
 
-static inline char *find_active_process_name(void) {
+static inline const char *intern_process_name_for_psn(ProcessSerialNumber *psn) {
+	char *process_name = find_process_name_for_psn(psn);
+	if (process_name == NULL)
+		return NULL;
+	const char *result = intern_string(process_name);
+	tr_free(process_name);
+	return result;
+}
+
+static inline const char *find_active_process_name(void) {
 	ProcessSerialNumber psn;
 	GetFrontProcess(&psn);
-	return find_process_name_for_psn(&psn);
+	return intern_process_name_for_psn(&psn);
 }
 #pragma clang diagnostic pop
 
@@ -52,12 +62,8 @@ static OSStatus carbon_event_handler(EventHandlerCallRef ref, EventRef event, vo
 		return -1;
 	}
 
-	if (carbon->process_name) {
-		tr_free(carbon->process_name);
-		carbon->process_name = NULL;
-	}
-
-	carbon->process_name = find_process_name_for_psn(&psn);
+	// interned once per app switch, so that matching it against hotkeys and the blocklist is a pointer compare.
+	carbon->process_name = intern_process_name_for_psn(&psn);
 
 	return noErr;
 }
@@ -7,7 +7,7 @@ struct carbon_event {
 	EventHandlerUPP handler;
 	EventTypeSpec type;
 	EventHandlerRef handler_ref;
-	char *volatile process_name;
+	const char *volatile process_name; // interned
 };
 
 char *find_process_name_for_pid(pid_t pid);
@@ -0,0 +1,567 @@
+#include "config_cache.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hotkey.h"
+#include "intern.h"
+#include "log.h"
+#include "mkhd.h"
+#include "parse.h"
+#include "sbuffer.h"
+#include "tokenize.h"
+#include "tr_malloc.h"
+#include "utils.h"
+
+// an action of the fragment that activates a layer. it refers to the fragment's own layer object after parsing, and
+// is pointed at the linked layer of the same name whenever the fragment is linked.
+struct layer_ref {
+	struct action *action;
+	const char *name; // interned
+};
+
+// what a file refers to, found by tokenizing it. (see `scan_file()`)
+struct file_scan {
+	const char **loads;		 // interned paths of the files it `.load`s
+	const char **alias_defs; // interned names of the aliases it defines
+	const char **alias_uses; // interned names of the aliases it uses, each once
+};
+
+// an alias as a file sees it when it is parsed.
+struct alias_binding {
+	const char *name; // interned
+	struct keyevent *keyevent;
+};
+
+struct config_fragment {
+	const char *path; // interned
+	struct trctx *memctx;
+	uint64_t content_hash; // the file's contents, hashed with the seed
+	uint64_t env_hash;	   // the aliases the file uses, as they were when it was parsed. see `alias_env_hash()`
+	bool error;
+	bool linked; // already part of the config being linked
+	struct file_scan scan;
+	char *messages; // the errors of the parse, reported whenever the fragment is linked
+
+	struct table layer_map; // <name, layer>, the layers this file mentions
+	struct layer_binding *bindings;
+	struct table blocklst;
+	struct table alias_map; // only the aliases defined in this file
+	struct config_options options;
+	struct load_directive *load_directives;
+	struct layer_ref *layer_refs;
+};
+
+// the chain of `.load`s that led to a file, to catch cycles.
+struct include_frame {
+	const char *path;
+	struct include_frame *parent;
+};
+
+// a file of the config, found by following the `.load`s before anything is parsed. (see `plan_file()`)
+struct planned_file {
+	const char *path; // interned
+	struct source_file source; // the text is NULL if it could not be read
+	uint64_t content_hash;
+	struct file_scan scan;
+	struct config_fragment *cached; // from an earlier link, with the same contents
+	int *dependencies;				// earlier files that define an alias this one uses
+	struct config_fragment *fragment;
+	bool done; // `fragment` is set, or there is none because the file could not be read
+	bool linked;
+};
+
+struct link_state {
+	struct config_cache *cache;
+	struct mkhd_state *mstate;
+	uint64_t seed;
+	char ***sources;
+	struct config_fragment **stale; // replaced by a newer parse, destroyed once linking is done
+	bool error;
+
+	// the files in the order they are going to be linked in, parsed ahead on a few threads.
+	struct planned_file *plan;
+	struct table planned; // <path, 1 + index into `plan`>
+	int next_job;
+	pthread_mutex_t lock;
+	pthread_cond_t job_done;
+};
+
+static void push_unique(const char ***names, const char *name) {
+	for (int i = 0; i < buf_len(*names); ++i) {
+		if ((*names)[i] == name)
+			return;
+	}
+	buf_push(*names, name);
+}
+
+static bool contains_name(const char **names, const char *name) {
+	for (int i = 0; i < buf_len(names); ++i) {
+		if (names[i] == name)
+			return true;
+	}
+	return false;
+}
+
+// aliases are expanded while parsing, so a file has to be parsed again if an alias it uses changed.
+// the combination is order independent.
+static uint64_t alias_env_hash(struct alias_binding *env, int count) {
+	uint64_t result = 0;
+	for (int i = 0; i < count; ++i) {
+		uint64_t hash = hash_bytes(HASH_BYTES_SEED, env[i].name, strlen(env[i].name));
+		result += hash_bytes(hash, env[i].keyevent, sizeof(struct keyevent));
+	}
+	return result;
+}
+
+static void init_name_table(struct table *table) {
+	table_init(table, 8, (table_hash_func)hash_interned, (table_compare_func)compare_interned);
+}
+
+// finds the files `source` loads and the aliases it defines and uses. tokenizing is enough for that, and it is all that
+// decides the order files can be parsed in. the lists are allocated in the current memory context.
+static void scan_file(const char *path, struct source_file source, struct file_scan *scan) {
+	memset(scan, 0, sizeof(struct file_scan));
+
+	struct tokenizer tokenizer;
+	tokenizer_init(&tokenizer, source.text, source.length);
+	struct token previous = {.type = Token_Unknown};
+	for (struct token token = get_token(&tokenizer); token.type != Token_EndOfStream;
+		 previous = token, token = get_token(&tokenizer)) {
+		bool after_option = previous.type == Token_Option;
+		if (after_option && token.type == Token_String && token_equals(previous, "load")) {
+			char *file = parser_load_path(path, token.text, token.length);
+			push_unique(&scan->loads, intern_string(file));
+			tr_free(file);
+		} else if (token.type == Token_Alias) {
+			const char *name = intern_string_count(token.text, token.length);
+			if (after_option && token_equals(previous, "alias")) {
+				push_unique(&scan->alias_defs, name);
+			} else {
+				push_unique(&scan->alias_uses, name);
+			}
+		}
+	}
+}
+
+static const char **copy_names(const char **names) {
+	const char **result = NULL;
+	for (int i = 0; i < buf_len(names); ++i) {
+		buf_push(result, names[i]);
+	}
+	return result;
+}
+
+// parses `source` into a fragment of its own, with the aliases in `env` defined. safe to run on any thread, as long as
+// no two of them parse the same file. the fragment's memory context is made a child of the cache's owner once the
+// fragment is linked.
+static struct config_fragment *parse_fragment(const char *path, struct source_file source, uint64_t content_hash,
+											  struct file_scan *scan, struct alias_binding *env, int env_count) {
+	struct trctx *memctx = trctx_new_region(path);
+	struct trctx *old_context = trctx_set_memcontext(memctx);
+
+	struct config_fragment *fragment = tr_malloc_tag(sizeof(struct config_fragment), "fragments");
+	memset(fragment, 0, sizeof(struct config_fragment));
+	fragment->path = path;
+	fragment->memctx = memctx;
+	fragment->content_hash = content_hash;
+	fragment->env_hash = alias_env_hash(env, env_count);
+	fragment->scan.loads = copy_names(scan->loads);
+	fragment->scan.alias_defs = copy_names(scan->alias_defs);
+	fragment->scan.alias_uses = copy_names(scan->alias_uses);
+	init_name_table(&fragment->layer_map);
+	init_name_table(&fragment->blocklst);
+	fragment->options = (struct config_options){.max_jobs = -1, .retrigger = Retrigger_Default};
+
+	struct table aliases;
+	init_name_table(&aliases);
+	for (int i = 0; i < env_count; ++i) {
+		table_add(&aliases, env[i].name, env[i].keyevent);
+	}
+
+	struct action **layer_actions = NULL;
+	struct layer_binding *bindings = NULL;
+	struct parser parser;
+	parser_init_text(&parser, source.text, source.length);
+	parser.file = path;
+	parser.layer_map = &fragment->layer_map;
+	parser.blocklst = &fragment->blocklst;
+	parser.alias_map = &aliases;
+	parser.options = &fragment->options;
+	parser.bindings = &bindings;
+	parser.layer_actions = &layer_actions;
+	parser.messages = &fragment->messages;
+	if (parse_config(&parser)) {
+		fragment->load_directives = parser.load_directives;
+	}
+	fragment->error = parser.error;
+	fragment->bindings = bindings;
+
+	// keep the aliases defined here, the others belong to fragments that may be gone by the next link.
+	init_name_table(&fragment->alias_map);
+	struct table_iter it = table_iter(&aliases);
+	while (table_iter_next(&it)) {
+		if (trctx_contains(memctx, it.value))
+			table_add(&fragment->alias_map, it.key, it.value);
+	}
+	table_free(&aliases);
+
+	for (int i = 0; i < buf_len(layer_actions); ++i) {
+		struct layer_ref ref = {.action = layer_actions[i], .name = layer_actions[i]->argument.layer->name};
+		buf_push(fragment->layer_refs, ref);
+	}
+	buf_free(layer_actions);
+
+	trctx_set_memcontext(old_context);
+	return fragment;
+}
+
+static struct planned_file *find_planned(struct link_state *link, const char *path) {
+	intptr_t index = (intptr_t)table_find(&link->planned, path);
+	return index ? &link->plan[index - 1] : NULL;
+}
+
+// adds `path` and the files it loads to the plan, in the order `link_file()` is going to link them in. (a file with
+// errors does not get its `.load`s linked, the files it loads are parsed for nothing then)
+static void plan_file(struct link_state *link, const char *path, struct include_frame *parent) {
+	for (struct include_frame *frame = parent; frame; frame = frame->parent) {
+		if (frame->path == path)
+			return; // reported by `link_file()`
+	}
+	if (find_planned(link, path))
+		return;
+
+	int index = buf_len(link->plan);
+	struct planned_file file = {.path = path};
+	parser_read_file(path, &file.source);
+	buf_push(link->plan, file);
+	table_add(&link->planned, path, (void *)(intptr_t)(index + 1));
+
+	struct planned_file *planned = &link->plan[index];
+	if (planned->source.text == NULL) {
+		planned->done = true;
+		return;
+	}
+
+	struct source_file source = planned->source;
+	planned->content_hash = hash_bytes(link->seed, source.text, source.length);
+	struct config_fragment *cached = table_find(&link->cache->fragments, path);
+	if (cached && cached->content_hash == planned->content_hash) {
+		planned->cached = cached;
+		planned->scan = cached->scan;
+	} else {
+		scan_file(path, source, &planned->scan);
+	}
+
+	for (int i = 0; i < index; ++i) {
+		const char **alias_defs = link->plan[i].scan.alias_defs;
+		for (int j = 0; j < buf_len(alias_defs); ++j) {
+			if (contains_name(planned->scan.alias_uses, alias_defs[j])) {
+				buf_push(planned->dependencies, i);
+				break;
+			}
+		}
+	}
+
+	// `planned` moves as the plan grows.
+	const char **loads = planned->scan.loads;
+	struct include_frame frame = {.path = path, .parent = parent};
+	for (int i = 0; i < buf_len(loads); ++i) {
+		plan_file(link, loads[i], &frame);
+	}
+}
+
+// parses a planned file, or takes the cached fragment if neither the file nor the aliases it uses changed. the files
+// it depends on are done, so it sees the aliases linking the files before it would have defined.
+static void parse_planned(struct link_state *link, struct planned_file *file) {
+	int use_count = buf_len(file->scan.alias_uses);
+	struct alias_binding env[use_count + 1];
+	int env_count = 0;
+	for (int i = 0; i < use_count; ++i) {
+		const char *name = file->scan.alias_uses[i];
+		for (int j = buf_len(file->dependencies) - 1; j >= 0; --j) {
+			struct config_fragment *dependency = link->plan[file->dependencies[j]].fragment;
+			struct keyevent *keyevent = dependency ? table_find(&dependency->alias_map, name) : NULL;
+			if (keyevent) {
+				env[env_count++] = (struct alias_binding){.name = name, .keyevent = keyevent};
+				break;
+			}
+		}
+	}
+
+	struct config_fragment *cached = file->cached;
+	if (cached && !cached->error && cached->env_hash == alias_env_hash(env, env_count)) {
+		file->fragment = cached;
+	} else {
+		file->fragment = parse_fragment(file->path, file->source, file->content_hash, &file->scan, env, env_count);
+	}
+}
+
+static bool dependencies_done(struct link_state *link, struct planned_file *file) {
+	for (int i = 0; i < buf_len(file->dependencies); ++i) {
+		if (!link->plan[file->dependencies[i]].done)
+			return false;
+	}
+	return true;
+}
+
+// files are taken in plan order. the files one waits for come before it, so they are taken already, by threads that
+// do not wait for anything after them.
+static void *parse_worker(void *context) {
+	struct link_state *link = context;
+	pthread_mutex_lock(&link->lock);
+	while (link->next_job < buf_len(link->plan)) {
+		struct planned_file *file = &link->plan[link->next_job++];
+		if (file->done)
+			continue;
+		while (!dependencies_done(link, file)) {
+			pthread_cond_wait(&link->job_done, &link->lock);
+		}
+		pthread_mutex_unlock(&link->lock);
+
+		parse_planned(link, file);
+
+		pthread_mutex_lock(&link->lock);
+		file->done = true;
+		pthread_cond_broadcast(&link->job_done);
+	}
+	pthread_mutex_unlock(&link->lock);
+	return NULL;
+}
+
+// a thread per core, the calling one included. verbose output only makes sense in order, then it is just that one.
+static void parse_plan(struct link_state *link) {
+	int jobs = 0;
+	for (int i = 0; i < buf_len(link->plan); ++i) {
+		if (!link->plan[i].done)
+			++jobs;
+	}
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int thread_count = verbose ? 0 : (int)(cores < jobs ? cores : jobs) - 1;
+
+	pthread_mutex_init(&link->lock, NULL);
+	pthread_cond_init(&link->job_done, NULL);
+	pthread_t threads[thread_count > 0 ? thread_count : 1];
+	int started = 0;
+	while (started < thread_count && pthread_create(&threads[started], NULL, parse_worker, link) == 0) {
+		++started;
+	}
+	parse_worker(link);
+	for (int i = 0; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_cond_destroy(&link->job_done);
+	pthread_mutex_destroy(&link->lock);
+}
+
+// the aliases in `uses` as the files linked so far define them.
+static int linked_env(struct link_state *link, const char **uses, struct alias_binding *env) {
+	int env_count = 0;
+	for (int i = 0; i < buf_len(uses); ++i) {
+		struct keyevent *keyevent = table_find(&link->mstate->alias_map, uses[i]);
+		if (keyevent)
+			env[env_count++] = (struct alias_binding){.name = uses[i], .keyevent = keyevent};
+	}
+	return env_count;
+}
+
+// adds everything the fragment defines to the config, the same way parsing the file into the config's own tables
+// would have. bindings are replayed one by one rather than merging the fragment's tables, because which binding
+// `table_replace()` overwrites depends on what the layer already contains.
+static void link_fragment(struct link_state *link, struct config_fragment *fragment) {
+	struct mkhd_state *mstate = link->mstate;
+
+	struct table_iter it = table_iter(&fragment->layer_map);
+	while (table_iter_next(&it)) {
+		const char *name = it.key;
+		if (table_find(&mstate->layer_map, name) == NULL) {
+			struct layer *layer = create_new_layer(name);
+			table_add(&mstate->layer_map, layer->name, layer);
+		}
+	}
+
+	for (int i = 0; i < buf_len(fragment->bindings); ++i) {
+		struct layer_binding binding = fragment->bindings[i];
+		add_hotkey_to_layer(table_find(&mstate->layer_map, binding.layer), binding.hotkey);
+	}
+
+	it = table_iter(&fragment->alias_map);
+	while (table_iter_next(&it)) {
+		table_replace(&mstate->alias_map, it.key, it.value);
+	}
+
+	it = table_iter(&fragment->blocklst);
+	while (table_iter_next(&it)) {
+		if (table_find(&mstate->blocklst, it.key) == NULL)
+			table_add(&mstate->blocklst, it.key, it.value);
+	}
+
+	if (fragment->options.max_jobs >= 0)
+		mstate->options.max_jobs = fragment->options.max_jobs;
+	if (fragment->options.retrigger != Retrigger_Default)
+		mstate->options.retrigger = fragment->options.retrigger;
+
+	for (int i = 0; i < buf_len(fragment->layer_refs); ++i) {
+		struct layer_ref ref = fragment->layer_refs[i];
+		ref.action->argument.layer = table_find(&mstate->layer_map, ref.name);
+	}
+}
+
+static void link_file(struct link_state *link, const char *path, struct include_frame *parent,
+					  struct load_directive *directive) {
+	struct config_cache *cache = link->cache;
+
+	for (struct include_frame *frame = parent; frame; frame = frame->parent) {
+		if (frame->path == path) {
+			warn("mkhd: '%s' ends up loading itself, ignoring load directive #%d:%d\n", path, directive->position.line,
+				 directive->position.cursor);
+			link->error = true;
+			return;
+		}
+	}
+
+	// only missing if a `.load` was parsed differently than it was scanned.
+	struct planned_file *file = find_planned(link, path);
+	if (file == NULL) {
+		plan_file(link, path, parent);
+		file = find_planned(link, path);
+	}
+	if (file->linked) {
+		warn("mkhd: '%s' is already loaded, ignoring load directive #%d:%d\n", path, directive->position.line,
+			 directive->position.cursor);
+		return;
+	}
+	file->linked = true;
+
+	if (file->source.text == NULL) {
+		if (directive) {
+			warn("mkhd: could not open file '%s' from load directive #%d:%d\n", path, directive->position.line,
+				 directive->position.cursor);
+		} else {
+			warn("mkhd: could not open file '%s'\n", path);
+		}
+		link->error = true;
+		return;
+	}
+
+	// files are parsed ahead as if every file planned before them is linked. one with errors is not, and neither are
+	// the files it loads, so the aliases a file sees now may not be the ones it was parsed with.
+	struct alias_binding env[buf_len(file->scan.alias_uses) + 1];
+	int env_count = linked_env(link, file->scan.alias_uses, env);
+	struct config_fragment *fragment = file->fragment;
+	if (fragment == NULL || fragment->env_hash != alias_env_hash(env, env_count)) {
+		fragment = parse_fragment(path, file->source, file->content_hash, &file->scan, env, env_count);
+		if (file->fragment && file->fragment != file->cached)
+			buf_push(link->stale, file->fragment);
+		file->fragment = fragment;
+	}
+
+	struct config_fragment *previous = table_find(&cache->fragments, path);
+	if (fragment != previous) {
+		if (previous)
+			buf_push(link->stale, previous);
+		trctx_set_parent(fragment->memctx, cache->owner);
+		struct trctx *old_context = trctx_set_memcontext(cache->memctx);
+		table_replace(&cache->fragments, path, fragment);
+		trctx_set_memcontext(old_context);
+		cache->files_parsed++;
+	} else {
+		cache->files_cached++;
+	}
+
+	fragment->linked = true;
+	if (fragment->error)
+		link->error = true;
+	if (buf_len(fragment->messages))
+		warn("%.*s", (int)buf_len(fragment->messages), fragment->messages);
+	buf_push(*link->sources, copy_string_malloc(path));
+	link_fragment(link, fragment);
+
+	// files are linked in the order they are loaded in, after the file that loads them.
+	struct include_frame frame = {.path = path, .parent = parent};
+	for (int i = 0; i < buf_len(fragment->load_directives); ++i) {
+		struct load_directive *load = &fragment->load_directives[i];
+		link_file(link, intern_string(load->file), &frame, load);
+	}
+}
+
+static void free_plan(struct link_state *link) {
+	for (int i = 0; i < buf_len(link->plan); ++i) {
+		struct planned_file *file = &link->plan[i];
+		parser_free_file(&file->source);
+		buf_free(file->dependencies);
+		if (file->cached == NULL) {
+			buf_free(file->scan.loads);
+			buf_free(file->scan.alias_defs);
+			buf_free(file->scan.alias_uses);
+		}
+	}
+	buf_free(link->plan);
+	table_free(&link->planned);
+}
+
+bool config_cache_link(struct config_cache *cache, struct mkhd_state *mstate, const char *file, uint64_t seed,
+					   char ***sources) {
+	if (!cache->initialized) {
+		struct trctx *old_context = trctx_set_memcontext(cache->memctx);
+		init_name_table(&cache->fragments);
+		trctx_set_memcontext(old_context);
+		cache->initialized = true;
+	}
+	cache->files_parsed = 0;
+	cache->files_cached = 0;
+
+	struct table_iter it = table_iter(&cache->fragments);
+	while (table_iter_next(&it)) {
+		struct config_fragment *fragment = it.value;
+		fragment->linked = false;
+	}
+
+	struct link_state link = {.cache = cache, .mstate = mstate, .seed = seed, .sources = sources};
+	init_name_table(&link.planned);
+	const char *root = intern_string(file);
+	plan_file(&link, root, NULL);
+	parse_plan(&link);
+	link_file(&link, root, NULL, NULL);
+
+	// files that are no longer part of the config, and files parsed ahead that were not linked after all.
+	it = table_iter(&cache->fragments);
+	while (table_iter_next(&it)) {
+		struct config_fragment *fragment = it.value;
+		if (!fragment->linked)
+			buf_push(link.stale, fragment);
+	}
+	for (int i = 0; i < buf_len(link.plan); ++i) {
+		struct planned_file *planned = &link.plan[i];
+		if (planned->fragment && planned->fragment != planned->cached && !planned->linked)
+			buf_push(link.stale, planned->fragment);
+	}
+	for (int i = 0; i < buf_len(link.stale); ++i) {
+		struct config_fragment *fragment = link.stale[i];
+		if (table_find(&cache->fragments, fragment->path) == fragment)
+			table_remove(&cache->fragments, fragment->path);
+		trctx_destroy_context(fragment->memctx);
+	}
+	buf_free(link.stale);
+	free_plan(&link);
+
+	debug("mkhd: parsed %d config files, %d were unchanged.\n", cache->files_parsed, cache->files_cached);
+	return !link.error;
+}
+
+void config_cache_clear(struct config_cache *cache) {
+	if (!cache->initialized)
+		return;
+
+	struct table_iter it = table_iter(&cache->fragments);
+	while (table_iter_next(&it)) {
+		struct config_fragment *fragment = it.value;
+		trctx_destroy_context(fragment->memctx);
+	}
+	struct trctx *old_context = trctx_set_memcontext(cache->memctx);
+	table_free(&cache->fragments);
+	trctx_set_memcontext(old_context);
+	cache->initialized = false;
+}
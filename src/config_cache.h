@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hashtable.h"
+
+// parsed config files, kept across reloads.
+// every file of the config (the root file and everything it `.load`s) is parsed on its own into a fragment: the
+// layers, bindings, aliases and blocklist entries it defines, and the files it loads. fragments are linked into the
+// final config in load order. on reload a file is only parsed again if its contents, the keyboard layout or the
+// aliases it uses changed, the others are linked from the cache as they are.
+//
+// the files are found by following the `.load`s first, tokenizing each file only. they are then parsed on a thread per
+// core, a file that uses aliases waiting for the files before it that define them. linking stays in load order on the
+// calling thread, so the config is the same as parsing the files one after the other gives. the parser threads read
+// the keycode map, it has to be built before linking. (see `prepare_keycode_map()`)
+//
+// each fragment lives in a region context of its own, a child of `owner`. so the linked config (whose tables are
+// built in `owner`) and the fragments it refers to are all "owned" by `owner` as far as `trctx_contains()` goes.
+
+struct mkhd_state;
+struct trctx;
+
+struct config_cache {
+	struct trctx *memctx;	// the cache itself is allocated here, whatever the current memory context is
+	struct trctx *owner;	// parent of the fragments' contexts
+	struct table fragments; // <interned path, config_fragment>
+	bool initialized;
+	// stats of the last link
+	int files_parsed;
+	int files_cached;
+};
+
+// links the config in `file` into `mstate`'s (initialized and empty) tables, allocating in the current memory
+// context. `seed` identifies the keyboard layout, the shell and PATH, it is part of every fragment's key. every file
+// the config consists of is appended to `sources`.
+// returns false if a file could not be read, had errors, or was part of a `.load` cycle. whatever could be linked is
+// used anyway.
+bool config_cache_link(struct config_cache *cache, struct mkhd_state *mstate, const char *file, uint64_t seed,
+					   char ***sources);
+// drops every fragment. only safe when no config refers to them anymore.
+void config_cache_clear(struct config_cache *cache);
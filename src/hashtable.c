@@ -4,66 +4,203 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "log.h"
 #include "tr_malloc.h"
 
-static struct bucket *table_new_bucket(const void *key, void *value) {
-	struct bucket *bucket = tr_malloc(sizeof(struct bucket));
-	bucket->key = key;
-	bucket->value = value;
-	bucket->next = NULL;
-	return bucket;
+// grow (doubling) once an insertion would make the table more than 7/8 full.
+#define TABLE_MAX_LOAD_NUM 7
+#define TABLE_MAX_LOAD_DEN 8
+
+static inline uint32_t table_hash(struct table *table, const void *key) { return (uint32_t)table->hash(key); }
+
+// fibonacci hashing spreads weak hashes (eg. ones that only differ in the upper bits) over the low bits we index with.
+static inline uint32_t table_home(uint32_t hash, uint32_t mask) {
+	uint32_t h = hash * 2654435769u;
+	return (h ^ (h >> 16)) & mask;
+}
+
+#define TABLE_MIN_CAPACITY 4
+
+// smallest power of two that holds `count` entries without exceeding the maximum load factor.
+static int table_capacity_for(int count) {
+	int result = TABLE_MIN_CAPACITY;
+	while (count * TABLE_MAX_LOAD_DEN > result * TABLE_MAX_LOAD_NUM) {
+		result <<= 1;
+	}
+	return result;
+}
+
+static void table_alloc_entries(struct table *table, int capacity) {
+	table->capacity = capacity;
+	table->entries = tr_malloc_tag(sizeof(struct table_entry) * capacity, "tables");
+	memset(table->entries, 0, sizeof(struct table_entry) * capacity);
+}
+
+// returns the index of the first entry matching `key`, or -1.
+static int table_lookup(struct table *table, const void *key, uint32_t hash) {
+	uint32_t mask = table->capacity - 1;
+	uint32_t index = table_home(hash, mask);
+	for (uint32_t dist = 1;; ++dist, index = (index + 1) & mask) {
+		struct table_entry *entry = table->entries + index;
+		// robin hood invariant: once we meet an entry closer to its home than we are to ours, the key is not here.
+		if (entry->dist < dist) {
+			return -1;
+		}
+		if (entry->hash == hash && table->compare(entry->key, key)) {
+			return index;
+		}
+	}
 }
 
-static struct bucket **table_get_bucket(struct table *table, const void *key) {
-	struct bucket **bucket = table->buckets + (table->hash(key) % table->capacity);
-	while (*bucket) {
-		if (table->compare((*bucket)->key, key)) {
+// inserts a new entry after every entry that shares its home slot, shifting the rest of the run by one.
+// this keeps entries with the same hash in insertion order.
+static void table_insert_new(struct table *table, const void *key, void *value, uint32_t hash) {
+	uint32_t mask = table->capacity - 1;
+	uint32_t index = table_home(hash, mask);
+	struct table_entry carry = {.key = key, .value = value, .hash = hash, .dist = 1};
+
+	while (table->entries[index].dist >= carry.dist) {
+		index = (index + 1) & mask;
+		carry.dist++;
+	}
+	while (true) {
+		struct table_entry *entry = table->entries + index;
+		if (entry->dist == 0) {
+			*entry = carry;
 			break;
 		}
-		bucket = &(*bucket)->next;
+		struct table_entry displaced = *entry;
+		*entry = carry;
+		carry = displaced;
+		carry.dist++;
+		index = (index + 1) & mask;
+	}
+	++table->count;
+}
+
+// runs never cross an empty slot, so walking the table from one visits every run in probe order without splitting
+// a run at the wrap-around.
+static int table_first_empty(struct table *table) {
+	for (int i = 0; i < table->capacity; ++i) {
+		if (table->entries[i].dist == 0) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+static void table_rehash(struct table *table, int capacity) {
+	struct table_entry *old_entries = table->entries;
+	int old_capacity = table->capacity;
+	int start = table_first_empty(table);
+
+	table_alloc_entries(table, capacity);
+	table->count = 0;
+
+	for (int i = 1; i <= old_capacity; ++i) {
+		struct table_entry *entry = old_entries + ((start + i) & (old_capacity - 1));
+		if (entry->dist != 0) {
+			table_insert_new(table, entry->key, entry->value, entry->hash);
+		}
+	}
+	tr_free(old_entries);
+}
+
+static inline void table_ensure_mutable(struct table *table) {
+	if (table->frozen) {
+		error("mkhd: table: attempted to modify a frozen table\n");
+	}
+}
+
+// murmur3 finalizer, seeded.
+static inline uint32_t table_mph_mix(uint32_t hash, uint32_t seed) {
+	uint32_t h = hash ^ (seed * 0x9e3779b9u);
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+// maps a 32-bit value into [0, range) without a division.
+static inline uint32_t table_mph_reduce(uint32_t h, uint32_t range) { return (uint32_t)(((uint64_t)h * range) >> 32); }
+
+static int table_lookup_frozen(struct table *table, const void *key, uint32_t hash) {
+	struct table_frozen *frozen = table->frozen;
+	if (frozen->group_count == 0) {
+		return -1;
+	}
+	uint32_t bucket = table_mph_reduce(table_mph_mix(hash, frozen->salt), frozen->bucket_count);
+	uint32_t group = table_mph_reduce(table_mph_mix(hash, frozen->displacement[bucket]), frozen->group_count);
+	for (uint32_t i = frozen->group_first[group]; i < frozen->group_first[group + 1]; ++i) {
+		struct table_entry *entry = table->entries + i;
+		if (entry->hash == hash && table->compare(entry->key, key)) {
+			return i;
+		}
 	}
-	return bucket;
+	return -1;
 }
 
 void table_init(struct table *table, int capacity, table_hash_func hash, table_compare_func compare) {
 	table->count = 0;
-	table->capacity = capacity;
 	table->hash = hash;
 	table->compare = compare;
-	table->buckets = tr_malloc(sizeof(struct bucket *) * capacity);
-	memset(table->buckets, 0, sizeof(struct bucket *) * capacity);
+	table->frozen = NULL;
+	table_alloc_entries(table, table_capacity_for(capacity));
+}
+
+void table_reserve(struct table *table, int count) {
+	table_ensure_mutable(table);
+	int capacity = table_capacity_for(count);
+	if (capacity > table->capacity) {
+		table_rehash(table, capacity);
+	}
+}
+
+void table_shrink_to_fit(struct table *table) {
+	table_ensure_mutable(table);
+	int capacity = table_capacity_for(table->count);
+	if (capacity < table->capacity) {
+		table_rehash(table, capacity);
+	}
 }
 
 void table_free(struct table *table) {
-	for (int i = 0; i < table->capacity; ++i) {
-		struct bucket *next, *bucket = table->buckets[i];
-		while (bucket) {
-			next = bucket->next;
-			tr_free(bucket);
-			bucket = next;
-		}
+	if (table->entries) {
+		tr_free(table->entries);
+		table->entries = NULL;
 	}
-	if (table->buckets) {
-		tr_free(table->buckets);
-		table->buckets = NULL;
+	if (table->frozen) {
+		tr_free(table->frozen->displacement);
+		tr_free(table->frozen->group_first);
+		tr_free(table->frozen);
+		table->frozen = NULL;
 	}
+	table->count = 0;
 }
 
 void *table_find(struct table *table, const void *key) {
-	struct bucket *bucket = *table_get_bucket(table, key);
-	return bucket ? bucket->value : NULL;
+	uint32_t hash = table_hash(table, key);
+	int index = table->frozen ? table_lookup_frozen(table, key, hash) : table_lookup(table, key, hash);
+	return index >= 0 ? table->entries[index].value : NULL;
 }
 
 void table_newkeyvalue(struct table *table, const void *key, void *value, bool do_replace) {
-	struct bucket **bucket = table_get_bucket(table, key);
-	if (*bucket) {
-		if (do_replace || !(*bucket)->value) {
-			(*bucket)->value = value;
+	table_ensure_mutable(table);
+	uint32_t hash = table_hash(table, key);
+	int index = table_lookup(table, key, hash);
+	if (index >= 0) {
+		struct table_entry *entry = table->entries + index;
+		if (do_replace || !entry->value) {
+			entry->value = value;
 		}
-	} else {
-		*bucket = table_new_bucket(key, value);
-		++table->count;
+		return;
+	}
+	if ((table->count + 1) * TABLE_MAX_LOAD_DEN > table->capacity * TABLE_MAX_LOAD_NUM) {
+		table_rehash(table, table->capacity * 2);
 	}
+	table_insert_new(table, key, value, hash);
 }
 
 void table_add(struct table *table, const void *key, void *value) { table_newkeyvalue(table, key, value, false); }
@@ -71,39 +208,253 @@ void table_add(struct table *table, const void *key, void *value) { table_newkey
 void table_replace(struct table *table, const void *key, void *value) { table_newkeyvalue(table, key, value, true); }
 
 void *table_remove(struct table *table, const void *key) {
-	void *result = NULL;
-	struct bucket *next, **bucket = table_get_bucket(table, key);
-	if (*bucket) {
-		result = (*bucket)->value;
-		next = (*bucket)->next;
-		tr_free(*bucket);
-		*bucket = next;
-		--table->count;
+	table_ensure_mutable(table);
+	int index = table_lookup(table, key, table_hash(table, key));
+	if (index < 0) {
+		return NULL;
 	}
+
+	uint32_t mask = table->capacity - 1;
+	void *result = table->entries[index].value;
+
+	// backward shift deletion: pull the rest of the run one slot closer to home.
+	uint32_t next = (index + 1) & mask;
+	while (table->entries[next].dist > 1) {
+		table->entries[index] = table->entries[next];
+		table->entries[index].dist--;
+		index = next;
+		next = (next + 1) & mask;
+	}
+	memset(table->entries + index, 0, sizeof(struct table_entry));
+	--table->count;
+
 	return result;
 }
 
 void *table_reset(struct table *table, int *count) {
+	table_ensure_mutable(table);
 	void **values;
-	int capacity;
-	int index;
-	int item;
+	int item = 0;
+	int start = table_first_empty(table);
 
-	capacity = table->capacity;
 	*count = table->count;
 	values = tr_malloc(sizeof(void *) * table->count);
-	item = 0;
-
-	for (index = 0; index < capacity; ++index) {
-		struct bucket *next, **bucket = table->buckets + index;
-		while (*bucket) {
-			values[item++] = (*bucket)->value;
-			next = (*bucket)->next;
-			tr_free(*bucket);
-			*bucket = next;
-			--table->count;
+
+	for (int i = 1; i <= table->capacity; ++i) {
+		struct table_entry *entry = table->entries + ((start + i) & (table->capacity - 1));
+		if (entry->dist != 0) {
+			values[item++] = entry->value;
 		}
 	}
+	memset(table->entries, 0, sizeof(struct table_entry) * table->capacity);
+	table->count = 0;
 
 	return values;
 }
+
+struct table_iter table_iter(struct table *table) {
+	// frozen entries are stored densely, grouped by hash.
+	int start = table->frozen ? -1 : table_first_empty(table);
+	return (struct table_iter){.table = table, .start = start, .index = 0};
+}
+
+bool table_iter_next(struct table_iter *it) {
+	struct table *table = it->table;
+	if (table->frozen) {
+		if (it->index >= table->count)
+			return false;
+		struct table_entry *entry = table->entries + it->index++;
+		it->key = entry->key;
+		it->value = entry->value;
+		return true;
+	}
+	while (it->index < table->capacity) {
+		struct table_entry *entry = table->entries + ((it->start + ++it->index) & (table->capacity - 1));
+		if (entry->dist != 0) {
+			it->key = entry->key;
+			it->value = entry->value;
+			return true;
+		}
+	}
+	return false;
+}
+
+void table_stats(struct table *table, struct table_stats *stats) {
+	memset(stats, 0, sizeof(struct table_stats));
+	stats->count = table->count;
+	stats->capacity = table->capacity;
+	stats->load_factor = table->capacity ? (float)table->count / table->capacity : 0;
+
+	long total_probe = 0;
+	for (int i = 0; i < table->capacity; ++i) {
+		int dist = table->entries[i].dist;
+		if (dist == 0)
+			continue;
+		total_probe += dist;
+		if (dist > stats->longest_probe)
+			stats->longest_probe = dist;
+		stats->histogram[(dist < TABLE_STATS_HISTOGRAM ? dist : TABLE_STATS_HISTOGRAM) - 1]++;
+	}
+	stats->average_probe = table->count ? (float)total_probe / table->count : 0;
+}
+
+#define TABLE_MPH_MAX_SALTS 16
+#define TABLE_MPH_MAX_SEEDS (1 << 16)
+#define TABLE_MPH_BUCKET_LOAD 3 // average number of groups per bucket
+
+static int table_compare_entry_hash(const void *a, const void *b) {
+	const struct table_entry *x = a, *y = b;
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	// dist holds the entry's probe order while sorting, which keeps equal hashes in insertion order.
+	return x->dist < y->dist ? -1 : (x->dist > y->dist);
+}
+
+// tries to find a displacement seed for every bucket with the given salt. fills `group_slot` on success.
+static bool table_mph_search(uint32_t salt, int group_count, int bucket_count, uint32_t *group_hash,
+							 uint32_t *displacement, uint32_t *group_slot, int *bucket_first, int *bucket_groups,
+							 int *bucket_order, bool *taken) {
+	memset(bucket_first, 0, sizeof(int) * (bucket_count + 1));
+	for (int g = 0; g < group_count; ++g) {
+		bucket_first[table_mph_reduce(table_mph_mix(group_hash[g], salt), bucket_count) + 1]++;
+	}
+	int largest = 0;
+	for (int b = 0; b < bucket_count; ++b) {
+		if (bucket_first[b + 1] > largest)
+			largest = bucket_first[b + 1];
+		bucket_first[b + 1] += bucket_first[b];
+	}
+	int *fill = bucket_order; // not needed until the buckets are ordered below
+	memcpy(fill, bucket_first, sizeof(int) * bucket_count);
+	for (int g = 0; g < group_count; ++g) {
+		bucket_groups[fill[table_mph_reduce(table_mph_mix(group_hash[g], salt), bucket_count)]++] = g;
+	}
+
+	// place the largest buckets first, while most slots are still free.
+	int ordered = 0;
+	for (int size = largest; size > 0; --size) {
+		for (int b = 0; b < bucket_count; ++b) {
+			if (bucket_first[b + 1] - bucket_first[b] == size)
+				bucket_order[ordered++] = b;
+		}
+	}
+
+	memset(taken, 0, sizeof(bool) * group_count);
+	memset(displacement, 0, sizeof(uint32_t) * bucket_count);
+	for (int i = 0; i < ordered; ++i) {
+		int b = bucket_order[i];
+		int first = bucket_first[b], last = bucket_first[b + 1];
+		bool placed = false;
+		for (uint32_t seed = 0; seed < TABLE_MPH_MAX_SEEDS && !placed; ++seed) {
+			placed = true;
+			for (int k = first; k < last; ++k) {
+				uint32_t slot = table_mph_reduce(table_mph_mix(group_hash[bucket_groups[k]], seed), group_count);
+				if (taken[slot]) {
+					// undo the slots taken by this attempt.
+					for (int j = first; j < k; ++j)
+						taken[group_slot[bucket_groups[j]]] = false;
+					placed = false;
+					break;
+				}
+				taken[slot] = true;
+				group_slot[bucket_groups[k]] = slot;
+			}
+			if (placed)
+				displacement[b] = seed;
+		}
+		if (!placed)
+			return false;
+	}
+	return true;
+}
+
+bool table_freeze(struct table *table) {
+	if (table->frozen)
+		return true;
+
+	int count = table->count;
+	struct table_entry *sorted = tr_malloc(sizeof(struct table_entry) * (count + 1));
+	int item = 0;
+	struct table_iter it = table_iter(table);
+	for (int i = 1; i <= table->capacity; ++i) {
+		struct table_entry *entry = table->entries + ((it.start + i) & (table->capacity - 1));
+		if (entry->dist != 0) {
+			sorted[item] = *entry;
+			sorted[item].dist = item;
+			++item;
+		}
+	}
+	qsort(sorted, count, sizeof(struct table_entry), table_compare_entry_hash);
+
+	int group_count = 0;
+	uint32_t *group_hash = tr_malloc(sizeof(uint32_t) * (count + 1));
+	uint32_t *group_start = tr_malloc(sizeof(uint32_t) * (count + 1));
+	for (int i = 0; i < count; ++i) {
+		if (i == 0 || sorted[i].hash != sorted[i - 1].hash) {
+			group_hash[group_count] = sorted[i].hash;
+			group_start[group_count] = i;
+			++group_count;
+		}
+	}
+	group_start[group_count] = count;
+
+	int bucket_count = group_count / TABLE_MPH_BUCKET_LOAD + 1;
+	uint32_t *displacement = tr_malloc_tag(sizeof(uint32_t) * bucket_count, "tables");
+	uint32_t *group_slot = tr_malloc(sizeof(uint32_t) * (group_count + 1));
+	int *bucket_first = tr_malloc(sizeof(int) * (bucket_count + 1));
+	int *bucket_groups = tr_malloc(sizeof(int) * (group_count + 1));
+	int *bucket_order = tr_malloc(sizeof(int) * bucket_count);
+	bool *taken = tr_malloc(sizeof(bool) * (group_count + 1));
+
+	bool found = false;
+	uint32_t salt = 0;
+	for (int attempt = 0; attempt < TABLE_MPH_MAX_SALTS && !found; ++attempt) {
+		salt = table_mph_mix(attempt, 0x6d6b6864);
+		found = table_mph_search(salt, group_count, bucket_count, group_hash, displacement, group_slot, bucket_first,
+								 bucket_groups, bucket_order, taken);
+	}
+
+	if (found) {
+		struct table_frozen *frozen = tr_malloc_tag(sizeof(struct table_frozen), "tables");
+		frozen->salt = salt;
+		frozen->bucket_count = bucket_count;
+		frozen->group_count = group_count;
+		frozen->displacement = displacement;
+		frozen->group_first = tr_malloc_tag(sizeof(uint32_t) * (group_count + 1), "tables");
+
+		// lay the groups out in slot order.
+		struct table_entry *entries = tr_malloc_tag(sizeof(struct table_entry) * (count + 1), "tables");
+		uint32_t *slot_group = (uint32_t *)bucket_groups;
+		for (int g = 0; g < group_count; ++g) {
+			slot_group[group_slot[g]] = g;
+		}
+		int at = 0;
+		for (int slot = 0; slot < group_count; ++slot) {
+			int g = slot_group[slot];
+			frozen->group_first[slot] = at;
+			for (uint32_t i = group_start[g]; i < group_start[g + 1]; ++i) {
+				entries[at] = sorted[i];
+				entries[at].dist = i - group_start[g] + 1;
+				++at;
+			}
+		}
+		frozen->group_first[group_count] = count;
+
+		tr_free(table->entries);
+		table->entries = entries;
+		table->capacity = count;
+		table->frozen = frozen;
+	} else {
+		tr_free(displacement);
+	}
+
+	tr_free(sorted);
+	tr_free(group_hash);
+	tr_free(group_start);
+	tr_free(group_slot);
+	tr_free(bucket_first);
+	tr_free(bucket_groups);
+	tr_free(bucket_order);
+	tr_free(taken);
+	return found;
+}
@@ -1,26 +1,90 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef unsigned long (*table_hash_func)(const void *key);
 typedef int (*table_compare_func)(const void *key_a, const void *key_b);
 
-struct bucket {
+// open-addressing hash table (linear probing, robin hood ordering).
+// key/value pairs are stored inline in one flat array, so a lookup touches a single contiguous run of entries
+// instead of chasing a chain of separately allocated buckets.
+//
+// `compare` is always called as compare(stored_key, lookup_key) and does not have to be symmetric, but keys that
+// compare equal must hash to the same value. entries with the same hash are kept in insertion order, so the first
+// inserted key that matches a lookup wins (same as the previous chained implementation).
+//
+// a table can be frozen with `table_freeze()` once it is no longer going to change. a frozen table is immutable and
+// is looked up through a minimal perfect hash instead of probing. (see `struct table_frozen`)
+struct table_entry {
 	const void *key;
 	void *value;
-	struct bucket *next;
+	uint32_t hash;
+	uint32_t dist; // 1 + distance from the home slot. 0 marks an empty slot. (frozen: 1 + position within its group)
+};
+
+// minimal perfect hash over the distinct hashes of a frozen table (hash and displace, CHD style).
+// every distinct hash is a "group" of entries (usually one, more if keys of different specificity share a hash).
+// a hash picks a bucket with `salt`, the bucket's displacement seed then maps it to its group without collisions.
+struct table_frozen {
+	uint32_t salt;
+	int bucket_count;
+	int group_count;
+	uint32_t *displacement; // [bucket_count]
+	uint32_t *group_first;	// [group_count + 1], group i is entries[group_first[i] .. group_first[i + 1])
 };
+
 struct table {
 	int count;
-	int capacity;
+	int capacity; // always a power of two (frozen: equal to count)
 	table_hash_func hash;
 	table_compare_func compare;
-	struct bucket **buckets;
+	struct table_entry *entries;
+	struct table_frozen *frozen; // NULL unless frozen
+};
+
+// iterates over all entries in probe order (entries sharing a hash are visited in insertion order).
+//
+//   struct table_iter it = table_iter(table);
+//   while (table_iter_next(&it)) { use it.key / it.value }
+struct table_iter {
+	struct table *table;
+	int start;
+	int index;
+	const void *key;
+	void *value;
 };
 
+#define TABLE_STATS_HISTOGRAM 8
+
+struct table_stats {
+	int count;
+	int capacity;
+	float load_factor;
+	int longest_probe;					  // longest probe sequence needed to reach an entry (1 = in its home slot)
+	float average_probe;				  // average probe sequence length over all entries
+	int histogram[TABLE_STATS_HISTOGRAM]; // entries by probe length. the last slot collects everything longer.
+};
+
+// `capacity` is the number of entries the table should hold before it first grows.
+// the table grows automatically as entries are added, `table_reserve()` pre-sizes it when the final count is known.
 void table_init(struct table *table, int capacity, table_hash_func hash, table_compare_func compare);
 void table_free(struct table *table);
+void table_reserve(struct table *table, int count);
+// shrinks the entry array to the smallest size that fits the current entries. (tables never shrink on their own)
+void table_shrink_to_fit(struct table *table);
 
 void *table_find(struct table *table, const void *key);
 void table_add(struct table *table, const void *key, void *value);
 void table_replace(struct table *table, const void *key, void *value);
 void *table_remove(struct table *table, const void *key);
 void *table_reset(struct table *table, int *count);
+
+struct table_iter table_iter(struct table *table);
+bool table_iter_next(struct table_iter *it);
+
+void table_stats(struct table *table, struct table_stats *stats);
+
+// builds a minimal perfect hash over the table and makes it immutable. any later modification is a fatal error.
+// returns false (leaving the table untouched and mutable) if no perfect hash could be found.
+bool table_freeze(struct table *table);
@@ -1,9 +1,11 @@
 #include "hotkey.h"
 
 #include "carbon.h"
+#include "intern.h"
 #include "log.h"
 #include "mkhd.h"
 #include "sbuffer.h"
+#include "spawn.h"
 #include "synthesize.h"
 #include "tr_malloc.h"
 #include "utils.h"
@@ -15,9 +17,6 @@
 #define LMOD_OFFS 1
 #define RMOD_OFFS 2
 
-static char arg[] = "-c";
-static char *shell = NULL;
-
 static uint32_t cgevent_lrmod_flag[] = {
 	Event_Mask_Alt, Event_Mask_LAlt, Event_Mask_RAlt, Event_Mask_Shift,	  Event_Mask_LShift,   Event_Mask_RShift,
 	Event_Mask_Cmd, Event_Mask_LCmd, Event_Mask_RCmd, Event_Mask_Control, Event_Mask_LControl, Event_Mask_RControl,
@@ -61,40 +60,33 @@ bool compare_keyevent(struct keyevent *a, struct keyevent *b) {
 	}
 }
 
-unsigned long hash_keyevent(struct keyevent *a) { return ((uint64_t)a->type << 32) & a->key; }
-
-bool compare_string(char *a, char *b) {
-	while (*a && *b && *a == *b) {
-		++a;
-		++b;
-	}
-	return *a == '\0' && *b == '\0';
-}
-
-unsigned long hash_string(char *key) {
-	unsigned long hash = 0, high;
-	while (*key) {
-		hash = (hash << 4) + *key++;
-		high = hash & 0xF0000000;
-		if (high) {
-			hash ^= (high >> 24);
-		}
-		hash &= ~high;
+// compare_keyevent lets a generic modifier (eg. alt) match either of its sided variants (lalt/ralt), so the hash may
+// only look at which modifier groups are present, not at which side they are on.
+static uint32_t keyevent_modifier_groups(struct keyevent *a) {
+	uint32_t groups = 0;
+	for (int mod = 0; mod < array_count(hotkey_lrmod_flag); mod += 3) {
+		uint32_t group_flags = hotkey_lrmod_flag[mod] | hotkey_lrmod_flag[mod + LMOD_OFFS] |
+							   hotkey_lrmod_flag[mod + RMOD_OFFS];
+		if (a->flags & group_flags)
+			groups |= 1 << (mod / 3);
 	}
-	return hash;
+	return groups;
 }
 
-static inline void fork_and_exec(const char *command, bool do_wait) {
-	int cpid = fork();
-	if (cpid == 0) {
-		setsid();
-		char *exec[] = {shell, arg, (char *)command, NULL};
-		int status_code = execvp(exec[0], exec);
-		exit(status_code);
-	} else {
-		if (do_wait)
-			waitpid(cpid, NULL, 0);
+unsigned long hash_keyevent(struct keyevent *a) {
+	uint64_t h = a->type;
+	if (a->type == Event_Key || a->type == Event_KeyDown || a->type == Event_KeyUp) {
+		h = (h << 8) | keyevent_modifier_groups(a);
+		h = (h << 2) | (has_flags(a, Hotkey_Flag_Fn) << 1) | has_flags(a, Hotkey_Flag_NX);
+		h = (h << 32) | a->key;
 	}
+	// splitmix64 finalizer
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
 }
 
 static inline struct action *find_process_action(struct hotkey *hotkey, const char *process_name) {
@@ -104,8 +96,9 @@ static inline struct action *find_process_action(struct hotkey *hotkey, const ch
 	bool found = false;
 
 	if (process_name && hotkey->process_names) { // process-specific mappings
+		// both sides are interned.
 		for (int i = 0; i < buf_len(hotkey->process_names); ++i) {
-			if (same_string(process_name, hotkey->process_names[i])) {
+			if (process_name == hotkey->process_names[i]) {
 				result = hotkey->actions[i];
 				found = true;
 				break;
@@ -123,6 +116,21 @@ static struct action action_fallthrough = {.type = Action_Fallthrough, .argument
 static struct action action_noop = {.type = Action_NoOp, .argument = {NULL}};
 static struct action action_nocapture = {.type = Action_Nocapture, .argument = {NULL}};
 
+// the order is part of the snapshot format, append only.
+static struct action *builtin_actions[] = {&action_fallthrough, &action_noop, &action_nocapture};
+
+int builtin_action_id(struct action *action) {
+	for (int i = 0; i < array_count(builtin_actions); ++i) {
+		if (builtin_actions[i] == action)
+			return i;
+	}
+	return -1;
+}
+
+struct action *builtin_action(int id) {
+	return id >= 0 && id < array_count(builtin_actions) ? builtin_actions[id] : NULL;
+}
+
 // @pseudo_keys like @unmatched, @enter_layer, @exit_layer. See `enum keyevent_type`.
 static struct action *find_pseudo_keyevent(struct layer *layer, enum keyevent_type type) {
 	struct keyevent event = {.type = type};
@@ -143,6 +151,124 @@ static void recursive_layer_pop(struct mkhd_state *mstate, int popcnt) {
 	}
 }
 
+// a macro waiting for one of its commands to exit before it runs the actions after it. the macros it is nested in wait
+// along with it, each one is a frame.
+#define MACRO_DEPTH_MAX 8
+#define WAITING_MACROS_MAX 32
+
+struct macro_frame {
+	struct action *macro;
+	int next; // the action to run next
+};
+
+struct waiting_macro {
+	struct spawn_job job;	   // first, see `macro_command_exited()`
+	struct mkhd_state *mstate; // NULL if the config was released while the command was running
+	int in_layer;
+	int depth;
+	struct macro_frame frames[MACRO_DEPTH_MAX];
+};
+
+// a slot is taken while its job is running or waiting to run.
+static struct waiting_macro waiting_macros[WAITING_MACROS_MAX];
+
+static bool run_macro(struct mkhd_state *mstate, struct macro_frame *frames, int depth, int in_layer);
+
+static void macro_command_exited(struct spawn_job *job) {
+	// the slot is free again, and may be taken by the rest of the macro.
+	struct waiting_macro waiting = *(struct waiting_macro *)job;
+	if (waiting.mstate == NULL)
+		return;
+
+	// the layer stack may have changed meanwhile.
+	int in_layer = waiting.in_layer;
+	if (in_layer >= waiting.mstate->layerstack_cnt)
+		in_layer = waiting.mstate->layerstack_cnt - 1;
+	ddebug("mkhd: resuming macro\n");
+	run_macro(waiting.mstate, waiting.frames, waiting.depth, in_layer);
+}
+
+static bool has_actions_left(struct macro_frame *frames, int depth) {
+	for (int i = 0; i < depth; ++i) {
+		if (frames[i].next < buf_len(frames[i].macro->argument.actions))
+			return true;
+	}
+	return false;
+}
+
+// a Command or Exec action.
+static const char *command_text(struct action *action) {
+	return action->type == Action_Exec ? action->argument.exec->command : action->argument.str;
+}
+
+static bool run_command(struct mkhd_state *mstate, struct action *action, enum retrigger retrigger,
+						struct spawn_job *job) {
+	ddebug("mkhd: cmd: %s\n", command_text(action));
+	return spawn_action(mstate, action, retrigger, job);
+}
+
+// runs the command and has the rest of the macro wait for it.
+static void run_macro_command(struct mkhd_state *mstate, struct action *command, struct macro_frame *frames, int depth,
+							  int in_layer) {
+	// a command of a macro runs every time the macro does.
+	if (!has_actions_left(frames, depth)) {
+		run_command(mstate, command, Retrigger_Queue, NULL);
+		return;
+	}
+
+	struct waiting_macro *waiting = NULL;
+	for (int i = 0; i < WAITING_MACROS_MAX && waiting == NULL; ++i) {
+		if (!spawn_job_active(&waiting_macros[i].job))
+			waiting = &waiting_macros[i];
+	}
+	if (waiting == NULL) {
+		warn("mkhd: too many macros waiting for commands, not waiting for '%s'\n", command_text(command));
+		run_command(mstate, command, Retrigger_Queue, NULL);
+		run_macro(mstate, frames, depth, in_layer);
+		return;
+	}
+
+	waiting->job.exited = macro_command_exited;
+	waiting->mstate = mstate;
+	waiting->in_layer = in_layer;
+	waiting->depth = depth;
+	memcpy(waiting->frames, frames, sizeof(struct macro_frame) * depth);
+	if (!run_command(mstate, command, Retrigger_Queue, &waiting->job))
+		run_macro(mstate, frames, depth, in_layer);
+}
+
+// runs the actions of `frames[depth - 1].macro` from its next one on, and then those of the macros it is nested in. a
+// command suspends the macro until it exited, without blocking the caller.
+static bool run_macro(struct mkhd_state *mstate, struct macro_frame *frames, int depth, int in_layer) {
+	bool capture = false;
+	while (depth > 0) {
+		struct macro_frame *frame = &frames[depth - 1];
+		if (frame->next == buf_len(frame->macro->argument.actions)) {
+			--depth;
+			continue;
+		}
+
+		struct action *action = frame->macro->argument.actions[frame->next++];
+		ddebug("execute action #%d out of %d in macro\n", frame->next - 1, buf_len(frame->macro->argument.actions));
+		if (action->type == Action_Command || action->type == Action_Exec) {
+			run_macro_command(mstate, action, frames, depth, in_layer);
+			return true; // capture, like any command
+		} else if (action->type == Action_Macro && depth < MACRO_DEPTH_MAX) {
+			frames[depth++] = (struct macro_frame){.macro = action, .next = 0};
+		} else {
+			capture = execute_action(mstate, action, in_layer) || capture;
+		}
+	}
+	return capture;
+}
+
+void forget_waiting_macros(struct mkhd_state *mstate) {
+	for (int i = 0; i < WAITING_MACROS_MAX; ++i) {
+		if (spawn_job_active(&waiting_macros[i].job) && waiting_macros[i].mstate == mstate)
+			waiting_macros[i].mstate = NULL;
+	}
+}
+
 bool execute_action(struct mkhd_state *mstate, struct action *action, int in_layer) {
 	if (action == NULL) {
 		return false;
@@ -155,8 +281,8 @@ bool execute_action(struct mkhd_state *mstate, struct action *action, int in_lay
 	case Action_NoOp:
 		return true; // capture
 	case Action_Command:
-		fork_and_exec(action->argument.str, true);
-		ddebug("mkhd: cmd: %s\n", action->argument.str);
+	case Action_Exec:
+		run_command(mstate, action, action->retrigger ? action->retrigger : mstate->options.retrigger, NULL);
 		return true; // capture
 	case Action_Nocapture:
 		return false; // no capture
@@ -175,7 +301,7 @@ bool execute_action(struct mkhd_state *mstate, struct action *action, int in_lay
 				 mstate->layerstack[LAYERSTACK_MAX - 1].l->name);
 			return false; // no capture
 		}
-		struct layer *new_layer = table_find(&mstate->layer_map, action->argument.str);
+		struct layer *new_layer = action->argument.layer;
 		MS_CURRENT_LAYER(mstate) = (struct layerstack_frame){
 			.l = new_layer,
 			.oneshot = (action->type == Action_PushLayerOneshot),
@@ -190,12 +316,8 @@ bool execute_action(struct mkhd_state *mstate, struct action *action, int in_lay
 		recursive_layer_pop(mstate, mstate->layerstack_cnt - in_layer);
 		return true; // capture
 	case Action_Macro: {
-		bool capture = false;
-		for (int i = 0; i < buf_len(action->argument.actions); i++) {
-			ddebug("execute action #%d out of %d in macro\n", i, buf_len(action->argument.actions));
-			capture = execute_action(mstate, action->argument.actions[i], in_layer) || capture;
-		}
-		return capture;
+		struct macro_frame frames[MACRO_DEPTH_MAX] = {{.macro = action, .next = 0}};
+		return run_macro(mstate, frames, 1, in_layer);
 	}
 	case Action_SynthKeyRecursive:
 	case Action_SynthKeyNonRecursive: {
@@ -218,9 +340,34 @@ bool execute_action(struct mkhd_state *mstate, struct action *action, int in_lay
 	}
 }
 
+static inline bool is_key_event_type(enum keyevent_type type) {
+	return type == Event_Key || type == Event_KeyDown || type == Event_KeyUp;
+}
+
+static inline int dispatch_slot(struct keyevent *event) {
+	return (has_flags(event, Hotkey_Flag_NX) ? DISPATCH_KEYCODES : 0) + event->key;
+}
+
+static inline struct hotkey *layer_dispatch_find(struct layer_dispatch *dispatch, struct keyevent *event) {
+	int slot = dispatch_slot(event);
+	for (int i = dispatch->first[slot]; i < dispatch->first[slot + 1]; ++i) {
+		if (compare_keyevent(&dispatch->entries[i].event, event)) {
+			return dispatch->entries[i].hotkey;
+		}
+	}
+	return NULL;
+}
+
+static inline struct hotkey *find_hotkey_in_layer(struct layer *layer, struct keyevent *event) {
+	if (layer->dispatch && event->key < DISPATCH_KEYCODES && is_key_event_type(event->type)) {
+		return layer_dispatch_find(layer->dispatch, event);
+	}
+	return table_find(&layer->hotkey_map, event);
+}
+
 static struct action *find_keyevent_action_in_layer(struct layer *layer, struct keyevent *event,
 													const char *process_name) {
-	struct hotkey *hotkey = table_find(&layer->hotkey_map, event);
+	struct hotkey *hotkey = find_hotkey_in_layer(layer, event);
 	struct action *action = NULL;
 	if (hotkey == NULL) {
 		ddebug("unmatched in layer |%s\n", layer->name);
@@ -236,7 +383,7 @@ static struct action *find_keyevent_action_in_layer(struct layer *layer, struct
 	return action;
 }
 
-bool find_and_exec_keyevent(struct mkhd_state *mstate, struct keyevent *event, const char *process_name) {
+static bool find_and_exec_keyevent_impl(struct mkhd_state *mstate, struct keyevent *event, const char *process_name) {
 	int fallthrough_depth = mstate->layerstack_cnt - 1;
 
 #define cur_layer() (mstate->layerstack[fallthrough_depth])
@@ -281,8 +428,23 @@ bool find_and_exec_keyevent(struct mkhd_state *mstate, struct keyevent *event, c
 	}
 }
 
+// dispatching an event must not allocate. debug builds (MKHD_CHECK_EVENT_ALLOC, see makefile) enforce it.
+bool find_and_exec_keyevent(struct mkhd_state *mstate, struct keyevent *event, const char *process_name) {
+#ifdef MKHD_CHECK_EVENT_ALLOC
+	unsigned long allocations = trctx_total_allocation_count();
+	bool res = find_and_exec_keyevent_impl(mstate, event, process_name);
+	if (trctx_total_allocation_count() != allocations) {
+		error("mkhd: find_and_exec_keyevent: %lu allocation(s) while dispatching an event (type=%d key=%d flags=%d)\n",
+			  trctx_total_allocation_count() - allocations, event->type, event->key, event->flags);
+	}
+	return res;
+#else
+	return find_and_exec_keyevent_impl(mstate, event, process_name);
+#endif
+}
+
 static struct hotkey *create_pseudo_key_hotkey(enum keyevent_type type, struct action *action) {
-	struct hotkey *hotkey = tr_malloc(sizeof(struct hotkey));
+	struct hotkey *hotkey = tr_pool_alloc(sizeof(struct hotkey), "hotkeys");
 	memset(hotkey, 0, sizeof(struct hotkey));
 
 	hotkey->event.type = type;
@@ -295,12 +457,59 @@ void add_hotkey_to_layer(struct layer *layer, struct hotkey *hotkey) {
 	table_replace(&layer->hotkey_map, &hotkey->event, hotkey);
 }
 
+void compile_layer_dispatch(struct layer *layer) {
+	layer->dispatch = NULL;
+
+	int count = 0;
+	struct table_iter it = table_iter(&layer->hotkey_map);
+	while (table_iter_next(&it)) {
+		const struct keyevent *event = it.key;
+		if (is_key_event_type(event->type) && event->key < DISPATCH_KEYCODES)
+			++count;
+	}
+	if (count > UINT16_MAX) {
+		// too large to index with uint16_t offsets, keep using hotkey_map.
+		return;
+	}
+
+	struct layer_dispatch *dispatch = tr_malloc_tag(sizeof(struct layer_dispatch), "dispatch");
+	memset(dispatch, 0, sizeof(struct layer_dispatch));
+	dispatch->entries = tr_malloc_tag(sizeof(struct dispatch_entry) * count, "dispatch");
+
+	// counting sort by slot. iterating in probe order keeps keys with equal hashes (the only ones that can match the
+	// same event) in insertion order, so the first match within a slot is the one `table_find()` would return.
+	it = table_iter(&layer->hotkey_map);
+	while (table_iter_next(&it)) {
+		struct keyevent *event = (struct keyevent *)it.key;
+		if (is_key_event_type(event->type) && event->key < DISPATCH_KEYCODES)
+			dispatch->first[dispatch_slot(event) + 1]++;
+	}
+	for (int slot = 0; slot < DISPATCH_SLOTS; ++slot) {
+		dispatch->first[slot + 1] += dispatch->first[slot];
+	}
+	uint16_t fill[DISPATCH_SLOTS];
+	memcpy(fill, dispatch->first, sizeof(fill));
+
+	it = table_iter(&layer->hotkey_map);
+	while (table_iter_next(&it)) {
+		struct keyevent *event = (struct keyevent *)it.key;
+		if (is_key_event_type(event->type) && event->key < DISPATCH_KEYCODES) {
+			dispatch->entries[fill[dispatch_slot(event)]++] = (struct dispatch_entry){
+				.event = *event,
+				.hotkey = it.value,
+			};
+		}
+	}
+
+	layer->dispatch = dispatch;
+}
+
 struct layer *create_new_layer(const char *name) {
-	struct layer *layer = tr_malloc(sizeof(struct layer));
+	struct layer *layer = tr_pool_alloc(sizeof(struct layer), "layers");
 	memset(layer, 0, sizeof(struct layer));
-	layer->name = copy_string_malloc(name);
+	layer->name = name;
 
-	table_init(&layer->hotkey_map, 131, (table_hash_func)hash_keyevent, (table_compare_func)compare_keyevent);
+	table_init(&layer->hotkey_map, 8, (table_hash_func)hash_keyevent, (table_compare_func)compare_keyevent);
 
 	add_hotkey_to_layer(layer, create_pseudo_key_hotkey(Event_Unmatched, &action_fallthrough));
 	add_hotkey_to_layer(layer, create_pseudo_key_hotkey(Event_EnterLayer, &action_noop));
@@ -367,9 +576,3 @@ bool intercept_systemkey(CGEventRef event, struct keyevent *eventkey) {
 	return result;
 }
 
-void init_shell(void) {
-	if (!shell) {
-		char *env_shell = getenv("SHELL");
-		shell = env_shell ? env_shell : "/bin/bash";
-	}
-}
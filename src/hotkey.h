@@ -55,6 +55,7 @@ struct carbon_event;
 enum action_type {
 	Action_NoOp = 0,  // do nothing but capture the key event
 	Action_Command,	  // run a command (capture the key event)
+	Action_Exec,	  // run a command that needs no shell, directly (capture the key event)
 	Action_Nocapture, // do nothing and keep the original OS behaviour of the key event
 
 	// layer stack manipulation actions
@@ -67,7 +68,7 @@ enum action_type {
 						// once an event falls through the lowest layer, it behaves like a
 						// Nocapture and registers as a regular key press.
 
-	Action_Macro, // execute multiple actions (sequentially, but keep in mind that Action_Commands are asynchronous)
+	Action_Macro, // execute multiple actions in order. the ones after a command wait for it to exit (in the background)
 	Action_SynthKeyRecursive,	 // synthesize a key event.
 	Action_SynthKeyNonRecursive, // synthesize a key event. (do not see the synthesized key presses as hotkeys)
 
@@ -75,10 +76,28 @@ enum action_type {
 	Action_Resume, // re-enable mkhd key event listening.
 };
 
+// what a command bound to a key does when the key triggers it again before its last run is done. see `.retrigger`.
+enum retrigger {
+	Retrigger_Default = 0, // as the config's `.retrigger` says. (`queue` if it says nothing)
+	Retrigger_Queue,	   // run it again
+	Retrigger_Coalesce,	   // run it once more after the last run exited, however often it was triggered meanwhile
+	Retrigger_Drop,		   // do nothing
+};
+
+// a command that is only a program and its arguments, split when the config is parsed.
+struct exec_command {
+	const char *command; // as it was written
+	const char *path;	 // of the program, found in PATH when the config was parsed
+	char **argv;		 // sbuffer, NULL terminated
+};
+
 struct action {
 	enum action_type type;
+	uint8_t retrigger; // enum retrigger, of a Command or Exec action bound to a key
 	union {
-		const char *str;			// Command, PushLayer, PushLayerOneshot
+		const char *str;			// Command
+		struct exec_command *exec;	// Exec
+		struct layer *layer;		// PushLayer, PushLayerOneshot
 		struct action **actions;	// Macro
 		struct keyevent *keyevents; // Action_SynthKey[Recursive|NonRecursive]
 	} argument;
@@ -107,15 +126,33 @@ struct keyevent {
 struct hotkey {
 	struct keyevent event;
 
-	char **process_names;
+	const char **process_names; // interned
 	struct action **actions;
 
 	struct action *process_default_action;
 };
 
+// keycodes are 8-bit and the NX flag splits them into two separate key spaces.
+#define DISPATCH_KEYCODES 256
+#define DISPATCH_SLOTS (2 * DISPATCH_KEYCODES)
+
+struct dispatch_entry {
+	struct keyevent event; // the key as stored in hotkey_map
+	struct hotkey *hotkey;
+};
+
+// a layer's key bindings compiled into an array indexed directly by keycode.
+// entries[first[slot] .. first[slot + 1]) hold every binding of one keycode (all event types and modifier variants),
+// in the same order `table_find()` would try them.
+struct layer_dispatch {
+	uint16_t first[DISPATCH_SLOTS + 1];
+	struct dispatch_entry *entries;
+};
+
 struct layer {
-	const char *name;
-	struct table hotkey_map; // <keyevent, hotkey>
+	const char *name; // interned
+	struct table hotkey_map;		 // <keyevent, hotkey>. source of truth while building the config.
+	struct layer_dispatch *dispatch; // compiled from hotkey_map by `compile_layer_dispatch()`. NULL until then.
 };
 
 struct layerstack_frame {
@@ -127,9 +164,6 @@ static inline void add_flags(struct keyevent *event, uint32_t flag) { event->fla
 static inline bool has_flags(struct keyevent *event, uint32_t flag) { return event->flags & flag; }
 static inline void clear_flags(struct keyevent *event, uint32_t flag) { event->flags &= ~flag; }
 
-bool compare_string(char *a, char *b);
-unsigned long hash_string(char *key);
-
 bool compare_keyevent(struct keyevent *a, struct keyevent *b);
 unsigned long hash_keyevent(struct keyevent *a);
 
@@ -142,7 +176,13 @@ struct mkhd_state;
 bool find_and_exec_keyevent(struct mkhd_state *mstate, struct keyevent *event, const char *process_name);
 bool execute_action(struct mkhd_state *mstate, struct action *action, int in_layer);
 
-struct layer *create_new_layer(const char *name_moved);
+struct layer *create_new_layer(const char *name_interned);
 void add_hotkey_to_layer(struct layer *layer, struct hotkey *hotkey);
-
-void init_shell(void);
+// actions like @fallthrough are static and shared by every config. they are identified by a stable id in snapshots.
+int builtin_action_id(struct action *action); // -1 if `action` is not a builtin one
+struct action *builtin_action(int id);		  // NULL if there is no such action
+// must be called again after modifying `layer->hotkey_map`.
+void compile_layer_dispatch(struct layer *layer);
+
+// drops the macros of `mstate` that are waiting for a command, before the config is released.
+void forget_waiting_macros(struct mkhd_state *mstate);
@@ -140,10 +140,7 @@ static inline void hotloader_add_watched_entry(struct hotloader *hotloader, stru
 	hotloader->watch_list[hotloader->watch_count++] = entry;
 }
 
-bool hotloader_add_catalog(struct hotloader *hotloader, const char *directory, const char *extension) {
-	if (hotloader->enabled)
-		return false;
-
+static bool hotloader_add_catalog_impl(struct hotloader *hotloader, const char *directory, const char *extension) {
 	char *real_path = resolve_symlink(directory);
 	if (!real_path)
 		return false;
@@ -161,10 +158,17 @@ bool hotloader_add_catalog(struct hotloader *hotloader, const char *directory, c
 	return true;
 }
 
-bool hotloader_add_file(struct hotloader *hotloader, const char *file) {
+bool hotloader_add_catalog(struct hotloader *hotloader, const char *directory, const char *extension) {
 	if (hotloader->enabled)
 		return false;
 
+	struct trctx *old_context = trctx_set_memcontext(hotloader->memctx ? hotloader->memctx : trctx_g_ctx);
+	bool result = hotloader_add_catalog_impl(hotloader, directory, extension);
+	trctx_set_memcontext(old_context);
+	return result;
+}
+
+static bool hotloader_add_file_impl(struct hotloader *hotloader, const char *file) {
 	char *real_path = resolve_symlink(file);
 	if (!real_path)
 		return false;
@@ -181,6 +185,16 @@ bool hotloader_add_file(struct hotloader *hotloader, const char *file) {
 	return true;
 }
 
+bool hotloader_add_file(struct hotloader *hotloader, const char *file) {
+	if (hotloader->enabled)
+		return false;
+
+	struct trctx *old_context = trctx_set_memcontext(hotloader->memctx ? hotloader->memctx : trctx_g_ctx);
+	bool result = hotloader_add_file_impl(hotloader, file);
+	trctx_set_memcontext(old_context);
+	return result;
+}
+
 void hotloader_debug(struct hotloader *hotloader) {
 	for (int i = 0; i < hotloader->watch_count; ++i) {
 		debug("\t%s\n", hotloader->watch_list[i].file_info.absolutepath);
@@ -235,5 +249,7 @@ void hotloader_end(struct hotloader *hotloader) {
 	}
 
 	CFRelease(hotloader->path);
+	struct trctx *memctx = hotloader->memctx;
 	memset(hotloader, 0, sizeof(struct hotloader));
+	hotloader->memctx = memctx;
 }
@@ -7,6 +7,7 @@
 typedef HOTLOADER_CALLBACK(hotloader_callback);
 
 struct watched_entry;
+struct trctx;
 struct hotloader {
 	FSEventStreamEventFlags flags;
 	FSEventStreamRef stream;
@@ -14,6 +15,7 @@ struct hotloader {
 	bool enabled;
 
 	hotloader_callback *callback;
+	struct trctx *memctx; // the watch list is allocated here, whatever the current memory context is
 	struct watched_entry *watch_list;
 	unsigned watch_capacity;
 	unsigned watch_count;
@@ -0,0 +1,700 @@
+#include "image.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hotkey.h"
+#include "intern.h"
+#include "log.h"
+#include "mkhd.h"
+#include "sbuffer.h"
+#include "tr_malloc.h"
+#include "utils.h"
+
+#define IMAGE_ALIGN 16
+
+struct image_builder {
+	struct trctx *owner;
+	// the image while it is being built. it moves as it grows, so everything refers to it by offset, and pointers
+	// within it hold offsets (listed in `relocations`) until it is mapped.
+	char *buffer;
+	size_t size;
+	size_t capacity;
+	struct table placed; // <original object, 1 + its offset in the image>
+	uint32_t *relocations;
+	struct image_external *externals;
+};
+
+typedef uint32_t (*image_placer)(struct image_builder *b, void *ptr);
+typedef void (*image_linker)(struct image_builder *b, uint32_t slot, void *ptr);
+
+#define IMAGE_AT(b, offset, type) ((type *)((b)->buffer + (offset)))
+
+static unsigned long hash_pointer(const void *ptr) { return (uintptr_t)ptr >> 3; }
+static int compare_pointer(const void *a, const void *b) { return a == b; }
+
+// copies `size` bytes at `ptr` into the image, once per object, and returns its offset.
+// `is_new` tells the caller whether the object still needs its pointers linked.
+static uint32_t image_place(struct image_builder *b, const void *ptr, size_t size, bool *is_new) {
+	uintptr_t placed = (uintptr_t)table_find(&b->placed, ptr);
+	if (placed) {
+		*is_new = false;
+		return placed - 1;
+	}
+
+	size_t offset = (b->size + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+	if (offset + size > b->capacity) {
+		while (offset + size > b->capacity)
+			b->capacity = b->capacity ? b->capacity * 2 : 4096;
+		b->buffer = tr_realloc(b->buffer, b->capacity);
+	}
+	memset(b->buffer + b->size, 0, offset - b->size);
+	memcpy(b->buffer + offset, ptr, size);
+	b->size = offset + size;
+
+	table_add(&b->placed, ptr, (void *)(uintptr_t)(offset + 1));
+	*is_new = true;
+	return offset;
+}
+
+// makes the pointer at `slot` refer to offset `target` of the image.
+static void image_relocate(struct image_builder *b, uint32_t slot, uint32_t target) {
+	*IMAGE_AT(b, slot, uintptr_t) = target;
+	buf_push(b->relocations, slot);
+}
+
+// points the pointer at `slot` to the image's copy of `ptr`, placing it first. pointers to objects that the config
+// doesn't own are left as they are.
+static void image_link(struct image_builder *b, uint32_t slot, void *ptr, image_placer placer) {
+	if (ptr && trctx_contains(b->owner, ptr)) {
+		image_relocate(b, slot, placer(b, ptr));
+	}
+}
+
+static void image_external(struct image_builder *b, uint32_t slot, enum image_external_kind kind) {
+	buf_push(b->externals, ((struct image_external){.slot = slot, .kind = kind}));
+}
+
+static uint32_t place_string(struct image_builder *b, void *ptr) {
+	bool is_new;
+	return image_place(b, ptr, strlen(ptr) + 1, &is_new);
+}
+
+static void image_link_name(struct image_builder *b, uint32_t slot, void *name) {
+	if (name && trctx_contains(b->owner, name)) {
+		image_relocate(b, slot, place_string(b, name));
+	} else if (name) {
+		image_external(b, slot, Image_External_Name);
+	}
+}
+
+static uint32_t place_keyevent(struct image_builder *b, void *ptr) {
+	bool is_new;
+	return image_place(b, ptr, sizeof(struct keyevent), &is_new);
+}
+
+// terminated by an Event_Null keyevent.
+static uint32_t place_keyevent_list(struct image_builder *b, void *ptr) {
+	struct keyevent *keyevents = ptr;
+	int count = 0;
+	while (keyevents[count].type != Event_Null)
+		count++;
+	bool is_new;
+	return image_place(b, ptr, sizeof(struct keyevent) * (count + 1), &is_new);
+}
+
+// sbuffers are referred to by a pointer past their header. the copy's capacity is trimmed to its length.
+static uint32_t place_buffer(struct image_builder *b, void *ptr, size_t elem_size, bool *is_new) {
+	struct buf_hdr *hdr = buf__hdr(ptr);
+	uint32_t offset = image_place(b, hdr, sizeof(struct buf_hdr) + hdr->len * elem_size, is_new);
+	if (*is_new)
+		IMAGE_AT(b, offset, struct buf_hdr)->cap = hdr->len;
+	return offset + offsetof(struct buf_hdr, buf);
+}
+
+// the names are interned and stay where they are.
+static uint32_t place_name_list(struct image_builder *b, void *ptr) {
+	const char **names = ptr;
+	bool is_new;
+	uint32_t offset = place_buffer(b, ptr, sizeof(const char *), &is_new);
+	if (is_new) {
+		for (int i = 0; i < buf_len(names); ++i) {
+			image_link_name(b, offset + i * sizeof(const char *), (void *)names[i]);
+		}
+	}
+	return offset;
+}
+
+// the arguments point into one string, each is placed on its own.
+static uint32_t place_argv(struct image_builder *b, void *ptr) {
+	char **argv = ptr;
+	bool is_new;
+	uint32_t offset = place_buffer(b, ptr, sizeof(char *), &is_new);
+	if (is_new) {
+		for (int i = 0; argv[i]; ++i) {
+			image_link(b, offset + i * sizeof(char *), argv[i], place_string);
+		}
+	}
+	return offset;
+}
+
+static uint32_t place_exec_command(struct image_builder *b, void *ptr) {
+	struct exec_command *exec = ptr;
+	bool is_new;
+	uint32_t offset = image_place(b, exec, sizeof(struct exec_command), &is_new);
+	if (is_new) {
+		image_link(b, offset + offsetof(struct exec_command, command), (void *)exec->command, place_string);
+		image_link(b, offset + offsetof(struct exec_command, path), (void *)exec->path, place_string);
+		image_link(b, offset + offsetof(struct exec_command, argv), exec->argv, place_argv);
+	}
+	return offset;
+}
+
+static uint32_t place_layer(struct image_builder *b, void *ptr);
+static uint32_t place_action(struct image_builder *b, void *ptr);
+
+static void image_link_action(struct image_builder *b, uint32_t slot, void *action) {
+	if (action && trctx_contains(b->owner, action)) {
+		image_relocate(b, slot, place_action(b, action));
+	} else if (action) {
+		image_external(b, slot, Image_External_Action);
+	}
+}
+
+static uint32_t place_action_list(struct image_builder *b, void *ptr) {
+	struct action **actions = ptr;
+	bool is_new;
+	uint32_t offset = place_buffer(b, ptr, sizeof(struct action *), &is_new);
+	if (is_new) {
+		for (int i = 0; i < buf_len(actions); ++i) {
+			image_link_action(b, offset + i * sizeof(struct action *), actions[i]);
+		}
+	}
+	return offset;
+}
+
+static uint32_t place_action(struct image_builder *b, void *ptr) {
+	struct action *action = ptr;
+	bool is_new;
+	uint32_t offset = image_place(b, action, sizeof(struct action), &is_new);
+	if (!is_new)
+		return offset;
+
+	uint32_t argument = offset + offsetof(struct action, argument);
+	switch (action->type) {
+	case Action_Command:
+		image_link(b, argument, (void *)action->argument.str, place_string);
+		break;
+	case Action_Exec:
+		image_link(b, argument, action->argument.exec, place_exec_command);
+		break;
+	case Action_PushLayer:
+	case Action_PushLayerOneshot:
+		image_link(b, argument, action->argument.layer, place_layer);
+		break;
+	case Action_Macro:
+		image_link(b, argument, action->argument.actions, place_action_list);
+		break;
+	case Action_SynthKeyRecursive:
+	case Action_SynthKeyNonRecursive:
+		image_link(b, argument, action->argument.keyevents, place_keyevent_list);
+		break;
+	default:
+		break;
+	}
+	return offset;
+}
+
+static uint32_t place_hotkey(struct image_builder *b, void *ptr) {
+	struct hotkey *hotkey = ptr;
+	bool is_new;
+	uint32_t offset = image_place(b, hotkey, sizeof(struct hotkey), &is_new);
+	if (is_new) {
+		// the default action first, it is the one nearly every lookup ends up with.
+		image_link_action(b, offset + offsetof(struct hotkey, process_default_action), hotkey->process_default_action);
+		image_link(b, offset + offsetof(struct hotkey, process_names), hotkey->process_names, place_name_list);
+		image_link(b, offset + offsetof(struct hotkey, actions), hotkey->actions, place_action_list);
+	}
+	return offset;
+}
+
+// hotkey_map is keyed by the event embedded in each hotkey.
+static uint32_t place_hotkey_event(struct image_builder *b, void *ptr) {
+	struct hotkey *hotkey = (struct hotkey *)((char *)ptr - offsetof(struct hotkey, event));
+	return place_hotkey(b, hotkey) + offsetof(struct hotkey, event);
+}
+
+// linkers for table keys and values.
+static void image_link_hotkey(struct image_builder *b, uint32_t slot, void *ptr) {
+	image_link(b, slot, ptr, place_hotkey);
+}
+
+static void image_link_hotkey_event(struct image_builder *b, uint32_t slot, void *ptr) {
+	image_link(b, slot, ptr, place_hotkey_event);
+}
+
+static void image_link_layer(struct image_builder *b, uint32_t slot, void *ptr) {
+	image_link(b, slot, ptr, place_layer);
+}
+
+static void image_link_keyevent(struct image_builder *b, uint32_t slot, void *ptr) {
+	image_link(b, slot, ptr, place_keyevent);
+}
+
+// links the storage of the table at `slot`, and the keys/values it refers to.
+static void image_link_table(struct image_builder *b, uint32_t slot, struct table *table, image_linker key_linker,
+							 image_linker value_linker) {
+	image_external(b, slot + offsetof(struct table, hash), Image_External_Function);
+	image_external(b, slot + offsetof(struct table, compare), Image_External_Function);
+	if (!table->entries || !trctx_contains(b->owner, table->entries))
+		return;
+
+	// frozen tables are allocated with one spare entry
+	bool is_new;
+	int entry_count = table->capacity + (table->frozen ? 1 : 0);
+	uint32_t entries = image_place(b, table->entries, sizeof(struct table_entry) * entry_count, &is_new);
+	image_relocate(b, slot + offsetof(struct table, entries), entries);
+	for (int i = 0; is_new && i < table->capacity; ++i) {
+		struct table_entry *entry = table->entries + i;
+		if (entry->dist == 0)
+			continue;
+		uint32_t at = entries + i * sizeof(struct table_entry);
+		if (key_linker)
+			key_linker(b, at + offsetof(struct table_entry, key), (void *)entry->key);
+		if (value_linker)
+			value_linker(b, at + offsetof(struct table_entry, value), entry->value);
+	}
+
+	struct table_frozen *frozen = table->frozen;
+	if (frozen && trctx_contains(b->owner, frozen)) {
+		uint32_t offset = image_place(b, frozen, sizeof(struct table_frozen), &is_new);
+		image_relocate(b, slot + offsetof(struct table, frozen), offset);
+		image_relocate(b, offset + offsetof(struct table_frozen, displacement),
+					   image_place(b, frozen->displacement, sizeof(uint32_t) * frozen->bucket_count, &is_new));
+		image_relocate(b, offset + offsetof(struct table_frozen, group_first),
+					   image_place(b, frozen->group_first, sizeof(uint32_t) * (frozen->group_count + 1), &is_new));
+	}
+}
+
+static uint32_t place_dispatch(struct image_builder *b, void *ptr) {
+	struct layer_dispatch *dispatch = ptr;
+	bool is_new;
+	uint32_t offset = image_place(b, dispatch, sizeof(struct layer_dispatch), &is_new);
+	int count = dispatch->first[DISPATCH_SLOTS];
+	if (!is_new || count == 0)
+		return offset;
+
+	// the entries, then the hotkeys in the same order.
+	uint32_t entries = image_place(b, dispatch->entries, sizeof(struct dispatch_entry) * count, &is_new);
+	image_relocate(b, offset + offsetof(struct layer_dispatch, entries), entries);
+	for (int i = 0; i < count; ++i) {
+		image_link(b, entries + i * sizeof(struct dispatch_entry) + offsetof(struct dispatch_entry, hotkey),
+			 dispatch->entries[i].hotkey, place_hotkey);
+	}
+	return offset;
+}
+
+static uint32_t place_layer(struct image_builder *b, void *ptr) {
+	struct layer *layer = ptr;
+	bool is_new;
+	uint32_t offset = image_place(b, layer, sizeof(struct layer), &is_new);
+	if (is_new) {
+		image_link_name(b, offset + offsetof(struct layer, name), (void *)layer->name);
+		image_link(b, offset + offsetof(struct layer, dispatch), layer->dispatch, place_dispatch);
+		image_link_table(b, offset + offsetof(struct layer, hotkey_map), &layer->hotkey_map, image_link_hotkey_event,
+						 image_link_hotkey);
+	}
+	return offset;
+}
+
+bool config_image_build(struct config_image *image, struct mkhd_state *mstate, struct trctx *owner) {
+	memset(image, 0, sizeof(struct config_image));
+
+	struct trctx *scratch = trctx_new_context("image");
+	struct trctx *old_context = trctx_set_memcontext(scratch);
+
+	struct image_builder b = {.owner = owner};
+	table_init(&b.placed, 1024, hash_pointer, compare_pointer);
+
+	// the root goes first, then the default layer and whatever it reaches, then the remaining layers.
+	struct config_image_root root = {
+		.layer_map = mstate->layer_map,
+		.blocklst = mstate->blocklst,
+		.alias_map = mstate->alias_map,
+		.default_layer = mstate->layerstack[0].l,
+		.options = mstate->options,
+	};
+	bool is_new;
+	uint32_t root_offset = image_place(&b, &root, sizeof(struct config_image_root), &is_new);
+	image_link(&b, root_offset + offsetof(struct config_image_root, default_layer), root.default_layer, place_layer);
+	image_link_table(&b, root_offset + offsetof(struct config_image_root, layer_map), &root.layer_map, image_link_name,
+					 image_link_layer);
+	image_link_table(&b, root_offset + offsetof(struct config_image_root, blocklst), &root.blocklst, image_link_name,
+					 image_link_name);
+	image_link_table(&b, root_offset + offsetof(struct config_image_root, alias_map), &root.alias_map, image_link_name,
+					 image_link_keyevent);
+
+	bool result = false;
+	char *base = mmap(NULL, b.size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	if (base == MAP_FAILED) {
+		warn("mkhd: could not map config image (%zu bytes)\n", b.size);
+	} else {
+		memcpy(base, b.buffer, b.size);
+		for (int i = 0; i < buf_len(b.relocations); ++i) {
+			*(uintptr_t *)(base + b.relocations[i]) += (uintptr_t)base;
+		}
+		if (mprotect(base, b.size, PROT_READ) != 0)
+			warn("mkhd: could not make config image read-only\n");
+
+		image->base = image->mapping = base;
+		image->size = image->mapping_size = b.size;
+		image->root = root_offset;
+		image->relocation_count = buf_len(b.relocations);
+		image->relocations = trctx_malloc(old_context, sizeof(uint32_t) * image->relocation_count);
+		memcpy(image->relocations, b.relocations, sizeof(uint32_t) * image->relocation_count);
+		image->external_count = buf_len(b.externals);
+		image->externals = trctx_malloc(old_context, sizeof(struct image_external) * image->external_count);
+		memcpy(image->externals, b.externals, sizeof(struct image_external) * image->external_count);
+
+		struct config_image_root *mapped = (struct config_image_root *)(base + root_offset);
+		mstate->layer_map = mapped->layer_map;
+		mstate->blocklst = mapped->blocklst;
+		mstate->alias_map = mapped->alias_map;
+		mstate->layerstack[0].l = mapped->default_layer;
+		mstate->options = mapped->options;
+		result = true;
+	}
+
+	trctx_set_memcontext(old_context);
+	trctx_destroy_context(scratch);
+	return result;
+}
+
+void config_image_release(struct config_image *image) {
+	if (image->mapping)
+		munmap(image->mapping, image->mapping_size);
+	// relocations and externals belong to the memory context they were allocated in, or to the mapping.
+	memset(image, 0, sizeof(struct config_image));
+}
+
+// snapshot file
+// header, the image (at SNAPSHOT_ALIGN, so it can be protected on its own), relocations, externals, the names they
+// refer to and the list of source files. pointers within the image hold offsets, external pointers hold 0.
+
+#define SNAPSHOT_MAGIC "mkhdsnap"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_ALIGN 16384 // the page size on arm64, a multiple of it everywhere else
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t layout_hash; // a snapshot written by a build with different struct layouts is rejected
+	uint64_t fingerprint; // of the source files and the seed
+	uint32_t image_offset, image_size, root;
+	uint32_t relocation_offset, relocation_count;
+	uint32_t external_offset, external_count;
+	uint32_t name_offset, name_size;
+	uint32_t source_offset, source_size, source_count;
+};
+
+// the order is part of the snapshot format, append only.
+typedef void (*image_function)(void);
+static const image_function image_functions[] = {
+	(image_function)hash_keyevent,
+	(image_function)compare_keyevent,
+	(image_function)hash_interned,
+	(image_function)compare_interned,
+};
+
+static int image_function_id(image_function function) {
+	for (int i = 0; i < array_count(image_functions); ++i) {
+		if (image_functions[i] == function)
+			return i;
+	}
+	return -1;
+}
+
+static uint32_t snapshot_layout_hash(void) {
+	uint32_t sizes[] = {
+		sizeof(void *),
+		sizeof(struct config_image_root),
+		sizeof(struct table),
+		sizeof(struct table_entry),
+		sizeof(struct table_frozen),
+		sizeof(struct layer),
+		sizeof(struct layer_dispatch),
+		sizeof(struct dispatch_entry),
+		sizeof(struct hotkey),
+		sizeof(struct action),
+		sizeof(struct keyevent),
+		sizeof(struct buf_hdr),
+		sizeof(struct image_external),
+	};
+	return (uint32_t)hash_bytes(HASH_BYTES_SEED, sizes, sizeof(sizes));
+}
+
+// hashes the path and contents of every source file. a missing file hashes differently from an empty one.
+static uint64_t snapshot_fingerprint(char **sources, int source_count, uint64_t seed) {
+	uint64_t hash = hash_bytes(HASH_BYTES_SEED, &seed, sizeof(seed));
+	for (int i = 0; i < source_count; ++i) {
+		hash = hash_bytes(hash, sources[i], strlen(sources[i]) + 1);
+		int handle = open(sources[i], O_RDONLY);
+		if (handle == -1) {
+			hash = hash_bytes(hash, &handle, sizeof(handle));
+			continue;
+		}
+		char buffer[16384];
+		ssize_t length;
+		while ((length = read(handle, buffer, sizeof(buffer))) > 0) {
+			hash = hash_bytes(hash, buffer, length);
+		}
+		close(handle);
+	}
+	return hash;
+}
+
+static bool snapshot_write_at(FILE *handle, long offset, const void *data, size_t size) {
+	return fseek(handle, offset, SEEK_SET) == 0 && (size == 0 || fwrite(data, size, 1, handle) == 1);
+}
+
+bool config_image_write(struct config_image *image, const char *path, char **sources, uint64_t seed) {
+	if (!image->base)
+		return false;
+
+	// back to offsets, and externals to what they refer to.
+	char *copy = tr_malloc(image->size);
+	memcpy(copy, image->base, image->size);
+	for (int i = 0; i < image->relocation_count; ++i) {
+		*(uintptr_t *)(copy + image->relocations[i]) -= (uintptr_t)image->base;
+	}
+
+	struct image_external *externals = tr_malloc(sizeof(struct image_external) * (image->external_count + 1));
+	char *names = NULL;
+	struct table name_offsets; // <interned name, 1 + its offset in `names`>
+	table_init(&name_offsets, 64, (table_hash_func)hash_interned, (table_compare_func)compare_interned);
+	bool result = true;
+	for (int i = 0; i < image->external_count; ++i) {
+		struct image_external external = image->externals[i];
+		void **slot = (void **)(copy + external.slot);
+		int index = -1;
+		switch (external.kind) {
+		case Image_External_Name: {
+			index = (int)(uintptr_t)table_find(&name_offsets, *slot) - 1;
+			if (index < 0) {
+				index = buf_len(names);
+				for (const char *c = *slot; *c; ++c)
+					buf_push(names, *c);
+				buf_push(names, '\0');
+				table_add(&name_offsets, *slot, (void *)(uintptr_t)(index + 1));
+			}
+		} break;
+		case Image_External_Action: index = builtin_action_id(*slot); break;
+		case Image_External_Function: index = image_function_id((image_function)*slot); break;
+		}
+		if (index < 0) {
+			warn("mkhd: snapshot: pointer at %u refers to nothing that can be saved\n", external.slot);
+			result = false;
+		}
+		external.index = index;
+		externals[i] = external;
+		*slot = NULL;
+	}
+	table_free(&name_offsets);
+
+	char *source_list = NULL;
+	for (int i = 0; i < buf_len(sources); ++i) {
+		for (const char *c = sources[i]; *c; ++c)
+			buf_push(source_list, *c);
+		buf_push(source_list, '\0');
+	}
+
+	struct snapshot_header header = {
+		.magic = SNAPSHOT_MAGIC,
+		.version = SNAPSHOT_VERSION,
+		.layout_hash = snapshot_layout_hash(),
+		.fingerprint = snapshot_fingerprint(sources, buf_len(sources), seed),
+		.image_offset = SNAPSHOT_ALIGN,
+		.image_size = image->size,
+		.root = image->root,
+		.relocation_count = image->relocation_count,
+		.external_count = image->external_count,
+		.name_size = buf_len(names),
+		.source_size = buf_len(source_list),
+		.source_count = buf_len(sources),
+	};
+	header.relocation_offset = header.image_offset + ((header.image_size + 7) & ~7u);
+	header.external_offset = header.relocation_offset + sizeof(uint32_t) * header.relocation_count;
+	header.name_offset = header.external_offset + sizeof(struct image_external) * header.external_count;
+	header.source_offset = header.name_offset + header.name_size;
+
+	// written next to the destination and renamed, so a running instance never maps a partial snapshot.
+	char temp_path[4096];
+	snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+	FILE *handle = result ? fopen(temp_path, "wb") : NULL;
+	if (handle) {
+		result = snapshot_write_at(handle, 0, &header, sizeof(header)) &&
+				 snapshot_write_at(handle, header.image_offset, copy, header.image_size) &&
+				 snapshot_write_at(handle, header.relocation_offset, image->relocations,
+								   sizeof(uint32_t) * header.relocation_count) &&
+				 snapshot_write_at(handle, header.external_offset, externals,
+								   sizeof(struct image_external) * header.external_count) &&
+				 snapshot_write_at(handle, header.name_offset, names, header.name_size) &&
+				 snapshot_write_at(handle, header.source_offset, source_list, header.source_size);
+		result = fclose(handle) == 0 && result;
+		if (result)
+			result = rename(temp_path, path) == 0;
+		else
+			unlink(temp_path);
+	} else if (result) {
+		warn("mkhd: could not write snapshot '%s'\n", temp_path);
+		result = false;
+	}
+
+	buf_free(source_list);
+	buf_free(names);
+	tr_free(externals);
+	tr_free(copy);
+	return result;
+}
+
+static bool snapshot_range_valid(size_t file_size, uint32_t offset, uint64_t size) {
+	return offset <= file_size && size <= file_size - offset;
+}
+
+// a table keyed by interned names hashes their addresses, which differ from one run to the next.
+static void rebuild_interned_table(struct table *table, struct table *mapped) {
+	table_init(table, mapped->count, (table_hash_func)hash_interned, (table_compare_func)compare_interned);
+	struct table_iter it = table_iter(mapped);
+	while (table_iter_next(&it)) {
+		table_add(table, it.key, it.value);
+	}
+	if (!table_freeze(table))
+		table_shrink_to_fit(table);
+}
+
+bool config_image_load(struct config_image *image, struct mkhd_state *mstate, const char *path, uint64_t seed,
+					   char ***sources) {
+	memset(image, 0, sizeof(struct config_image));
+
+	int handle = open(path, O_RDONLY);
+	if (handle == -1)
+		return false;
+	struct stat info;
+	char *mapping = MAP_FAILED;
+	if (fstat(handle, &info) == 0 && info.st_size >= sizeof(struct snapshot_header))
+		mapping = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, handle, 0);
+	close(handle);
+	if (mapping == MAP_FAILED) {
+		debug("mkhd: could not map snapshot '%s'\n", path);
+		return false;
+	}
+	size_t size = info.st_size;
+
+	struct snapshot_header *header = (struct snapshot_header *)mapping;
+	const char *reason = NULL;
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != SNAPSHOT_VERSION ||
+		header->layout_hash != snapshot_layout_hash()) {
+		reason = "written by a different version";
+	} else if (header->image_offset % SNAPSHOT_ALIGN != 0 || header->image_size < sizeof(struct config_image_root) ||
+			   !snapshot_range_valid(size, header->image_offset, header->image_size) ||
+			   header->root > header->image_size - sizeof(struct config_image_root) ||
+			   !snapshot_range_valid(size, header->relocation_offset,
+									 (uint64_t)sizeof(uint32_t) * header->relocation_count) ||
+			   !snapshot_range_valid(size, header->external_offset,
+									 (uint64_t)sizeof(struct image_external) * header->external_count) ||
+			   !snapshot_range_valid(size, header->name_offset, header->name_size) ||
+			   !snapshot_range_valid(size, header->source_offset, header->source_size) ||
+			   (header->source_size && mapping[header->source_offset + header->source_size - 1] != '\0') ||
+			   (header->name_size && mapping[header->name_offset + header->name_size - 1] != '\0')) {
+		reason = "corrupt";
+	}
+
+	char **source_list = NULL;
+	if (!reason) {
+		const char *source = mapping + header->source_offset;
+		for (int i = 0; i < header->source_count && source < mapping + header->source_offset + header->source_size;
+			 ++i) {
+			buf_push(source_list, (char *)source);
+			source += strlen(source) + 1;
+		}
+		if (buf_len(source_list) != header->source_count)
+			reason = "corrupt";
+		else if (snapshot_fingerprint(source_list, buf_len(source_list), seed) != header->fingerprint)
+			reason = "out of date";
+	}
+
+	char *base = mapping + header->image_offset;
+	uint32_t *relocations = (uint32_t *)(mapping + header->relocation_offset);
+	struct image_external *externals = (struct image_external *)(mapping + header->external_offset);
+	for (int i = 0; !reason && i < header->relocation_count; ++i) {
+		uintptr_t *slot = (uintptr_t *)(base + relocations[i]);
+		if (relocations[i] > header->image_size - sizeof(uintptr_t) || *slot >= header->image_size) {
+			reason = "corrupt";
+			break;
+		}
+		*slot += (uintptr_t)base;
+	}
+	for (int i = 0; !reason && i < header->external_count; ++i) {
+		struct image_external external = externals[i];
+		if (external.slot > header->image_size - sizeof(void *)) {
+			reason = "corrupt";
+			break;
+		}
+		void *target = NULL;
+		switch (external.kind) {
+		case Image_External_Name:
+			if (external.index < header->name_size)
+				target = (void *)intern_string(mapping + header->name_offset + external.index);
+			break;
+		case Image_External_Action: target = builtin_action(external.index); break;
+		case Image_External_Function:
+			if (external.index < array_count(image_functions))
+				target = (void *)image_functions[external.index];
+			break;
+		}
+		if (!target)
+			reason = "corrupt";
+		*(void **)(base + external.slot) = target;
+	}
+
+	if (reason) {
+		debug("mkhd: not using snapshot '%s', it is %s.\n", path, reason);
+		buf_free(source_list);
+		munmap(mapping, size);
+		return false;
+	}
+
+	for (int i = 0; i < buf_len(source_list); ++i) {
+		buf_push(*sources, copy_string_malloc(source_list[i]));
+	}
+	buf_free(source_list);
+
+	struct config_image_root *root = (struct config_image_root *)(base + header->root);
+	rebuild_interned_table(&mstate->layer_map, &root->layer_map);
+	rebuild_interned_table(&mstate->blocklst, &root->blocklst);
+	rebuild_interned_table(&mstate->alias_map, &root->alias_map);
+	mstate->options = root->options;
+	mstate->layerstack[0] = (struct layerstack_frame){
+		.l = root->default_layer,
+		.oneshot = false,
+	};
+	mstate->layerstack_cnt = 1;
+
+	if (mprotect(base, header->image_size, PROT_READ) != 0)
+		warn("mkhd: could not make config image read-only\n");
+
+	image->base = base;
+	image->size = header->image_size;
+	image->root = header->root;
+	image->relocations = relocations;
+	image->relocation_count = header->relocation_count;
+	image->externals = externals;
+	image->external_count = header->external_count;
+	image->mapping = mapping;
+	image->mapping_size = size;
+	return true;
+}
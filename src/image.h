@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hashtable.h"
+#include "mkhd.h"
+
+// config image
+// once a config is loaded and its tables are frozen, the whole object graph below `mkhd_state` (layers, their tables
+// and dispatch arrays, hotkeys, actions, command strings, keyevent lists) is copied into one contiguous block in
+// dispatch order and made read-only. a stray write to the live config faults instead of corrupting it.
+//
+// only objects owned by the memory context the config was built in are copied. anything else (interned names, the
+// builtin actions in hotkey.c, the tables' hash functions) is referenced as it is, and listed in `externals`.
+//
+// an image can be written to a snapshot file (`mkhd --compile`) and mapped back in on startup, which skips reading
+// and parsing the config altogether.
+
+struct mkhd_state;
+struct trctx;
+
+// the part of `mkhd_state` that lives in the image. (the layer stack changes at event time and stays outside)
+struct config_image_root {
+	struct table layer_map;
+	struct table blocklst;
+	struct table alias_map;
+	struct layer *default_layer;
+	struct config_options options;
+};
+
+enum image_external_kind {
+	Image_External_Name,	 // an interned string
+	Image_External_Action,	 // a builtin action, see `builtin_action_id()`
+	Image_External_Function, // a table's hash or compare function
+};
+
+// a pointer within the image to something outside of it.
+struct image_external {
+	uint32_t slot;
+	uint32_t kind : 8;
+	uint32_t index : 24; // snapshots only: the name's offset in the name list, or the id of the action/function
+};
+
+struct config_image {
+	void *base; // NULL if there is no image
+	size_t size;
+	uint32_t root; // offset of the `config_image_root`
+	// offsets of all pointers within the image that point into the image.
+	uint32_t *relocations;
+	int relocation_count;
+	struct image_external *externals;
+	int external_count;
+	// what to unmap on release. (a snapshot maps the whole file)
+	void *mapping;
+	size_t mapping_size;
+};
+
+// builds an image of `mstate`'s config, owned by `owner`, and points `mstate` at it. the relocations and externals
+// are allocated in the current memory context.
+// on failure `mstate` is left untouched and still refers to the objects in `owner`.
+bool config_image_build(struct config_image *image, struct mkhd_state *mstate, struct trctx *owner);
+void config_image_release(struct config_image *image);
+
+// writes `image` to a snapshot file at `path`. the snapshot is valid for as long as the `sources` it was built from
+// (the config file and everything it loads) are unchanged and `seed` (the keyboard layout, the shell and PATH) is the
+// same.
+bool config_image_write(struct config_image *image, const char *path, char **sources, uint64_t seed);
+// maps the snapshot at `path` as the image of `mstate`'s config, if it is still valid. its source files are appended
+// to `sources`. the tables keyed by interned names are rebuilt in the current memory context.
+bool config_image_load(struct config_image *image, struct mkhd_state *mstate, const char *path, uint64_t seed,
+					   char ***sources);
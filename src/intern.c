@@ -0,0 +1,66 @@
+#include "intern.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hashtable.h"
+#include "tr_malloc.h"
+#include "utils.h"
+
+struct symbol {
+	const char *text;
+	int length;
+};
+
+static struct trctx *memctx_intern = NULL;
+static struct table symbol_table; // <symbol, interned string>
+// configs are parsed on a worker thread while the main thread interns process names.
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long hash_symbol(struct symbol *symbol) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < symbol->length; ++i) {
+		hash ^= (unsigned char)symbol->text[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bool compare_symbol(struct symbol *a, struct symbol *b) {
+	return a->length == b->length && memcmp(a->text, b->text, a->length) == 0;
+}
+
+const char *intern_string_count(const char *s, int length) {
+	pthread_mutex_lock(&intern_lock);
+	struct trctx *old_context = trctx_set_memcontext(memctx_intern);
+	if (memctx_intern == NULL) {
+		memctx_intern = trctx_new_context("intern");
+		trctx_set_memcontext(memctx_intern);
+		table_init(&symbol_table, 64, (table_hash_func)hash_symbol, (table_compare_func)compare_symbol);
+	}
+
+	struct symbol lookup = {.text = s, .length = length};
+	const char *result = table_find(&symbol_table, &lookup);
+	if (result == NULL) {
+		// the symbol and its text share one allocation.
+		struct symbol *symbol = tr_pool_alloc(sizeof(struct symbol) + length + 1, "symbols");
+		char *text = (char *)(symbol + 1);
+		copy_string_count_nomalloc(text, s, length);
+		symbol->text = text;
+		symbol->length = length;
+		table_add(&symbol_table, symbol, text);
+		result = text;
+	}
+
+	trctx_set_memcontext(old_context);
+	pthread_mutex_unlock(&intern_lock);
+	return result;
+}
+
+const char *intern_string(const char *s) { return intern_string_count(s, strlen(s)); }
+
+unsigned long hash_interned(const char *s) { return (uintptr_t)s >> 3; }
+
+bool compare_interned(const char *a, const char *b) { return a == b; }
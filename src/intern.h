@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+
+// string interning.
+// every distinct string is stored exactly once, so interned strings can be compared (and hashed) by pointer.
+//
+// interned strings are never freed, not even on config reload. this keeps names that are obtained outside of the
+// config (eg. the name of the front process) comparable with names from any config generation.
+// interning is thread-safe, lookups of interned strings need no locking since they are never freed.
+
+const char *intern_string(const char *s);
+const char *intern_string_count(const char *s, int length);
+
+// hash/compare functions for tables keyed by interned strings.
+unsigned long hash_interned(const char *s);
+bool compare_interned(const char *a, const char *b);
@@ -0,0 +1,41 @@
+#pragma once
+
+// generated by tools/keywords.c (`make keywords`), do not edit.
+// modifier and key literal identifiers, see `find_keyword()` in tokenize.c.
+
+#include <stdint.h>
+
+#define KEYWORD_SLOTS 128
+
+// clang-format off
+static const uint8_t keyword_values[256] = {
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  6, 113,  72,   4,  79,  25,  95,  62,  55,  53,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0, 101,  69,  34,  78, 111,  43,   0,  99,  49,   0,  52,  66, 113,  13, 127,
+	 63,   0,  31,  27,   2, 120,   0,   0,  71,   7,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+};
+
+// 1 + the keyword's index, modifiers first and then key literals. 0 for an empty slot.
+static const uint8_t keyword_slots[128] = {
+	 59,  54,  55,   0,   0,   4,   0,   0,  12,   0,   3,   0,  53,   0,   0,  30,
+	 40,  61,   0,   9,   0,   0,  57,  38,   0,   0,   0,  37,   0,  14,   0,   0,
+	  0,  15,  18,  42,   0,  39,   0,   0,   0,  36,   0,  11,   1,   2,   0,  16,
+	 58,  51,  20,   0,   0,  32,   8,  26,  44,  24,   0,   0,   0,  31,   0,   0,
+	  0,  60,   6,  62,   0,   0,  25,  13,   0,   0,   0,  33,   0,  22,  17,   0,
+	  0,   0,   0,   0,  48,  21,  47,  27,   0,   0,   0,   0,  52,  46,  29,  34,
+	  0,  50,  56,   0,   7,   5,   0,  41,   0,  23,  10,  35,   0,   0,  43,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,  28,   0,   0,   0,  49,   0,  45,  19,
+};
+// clang-format on
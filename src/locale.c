@@ -5,11 +5,13 @@
 
 #include "carbon.h"
 #include "hashtable.h"
+#include "log.h"
 #include "sbuffer.h"
 #include "utils.h"
 
 static struct table keymap_table;
 static char **keymap_keys = NULL;
+static bool keymap_initialized = false;
 
 static struct trctx *memctx_locale = NULL;
 
@@ -50,7 +52,7 @@ static uint32_t layout_dependent_keycodes[] = {
 #pragma clang diagnostic ignored "-Wint-to-void-pointer-cast"
 bool initialize_keycode_map(void) {
 	if (memctx_locale == NULL)
-		memctx_locale = trctx_new_context();
+		memctx_locale = trctx_new_context("locale");
 	struct trctx *old_context = trctx_set_memcontext(memctx_locale);
 
 	UniChar chars[255];
@@ -69,7 +71,8 @@ bool initialize_keycode_map(void) {
 
 	trctx_free_everything(memctx_locale); // clean up old data.
 	keymap_keys = NULL;
-	table_init(&keymap_table, 61, (table_hash_func)hash_keymap, (table_compare_func)same_keymap);
+	table_init(&keymap_table, array_count(layout_dependent_keycodes), (table_hash_func)hash_keymap,
+			   (table_compare_func)same_keymap);
 
 	// todo: maybe cache it?
 	for (int i = 0; i < array_count(layout_dependent_keycodes); ++i) {
@@ -87,13 +90,38 @@ bool initialize_keycode_map(void) {
 		}
 	}
 
+	keymap_initialized = true;
 	trctx_set_memcontext(old_context);
 	// todo: do nothing if the keycode map did not changed.
 	return true;
 }
 #pragma clang diagnostic pop
 
+uint64_t keyboard_layout_fingerprint(void) {
+	uint64_t hash = HASH_BYTES_SEED;
+	TISInputSourceRef keyboard = TISCopyCurrentASCIICapableKeyboardLayoutInputSource();
+	CFDataRef uchr = (CFDataRef)TISGetInputSourceProperty(keyboard, kTISPropertyUnicodeKeyLayoutData);
+	if (uchr)
+		hash = hash_bytes(hash, CFDataGetBytePtr(uchr), CFDataGetLength(uchr));
+	CFRelease(keyboard);
+
+	UInt32 keyboard_type = LMGetKbdType();
+	return hash_bytes(hash, &keyboard_type, sizeof(keyboard_type));
+}
+
+bool prepare_keycode_map(void) {
+	if (keymap_initialized)
+		return true;
+	if (initialize_keycode_map())
+		return true;
+	warn("mkhd: could not initialize keycode map!\n");
+	return false;
+}
+
 uint32_t keycode_from_char(char key) {
+	// built on first use, so a config loaded from a snapshot never needs it.
+	prepare_keycode_map();
+
 	char lookup_key[] = {key, '\0'};
 	uint32_t keycode = (uint32_t)(uintptr_t)table_find(&keymap_table, &lookup_key);
 	return keycode;
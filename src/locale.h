@@ -9,5 +9,10 @@
 			  CFDictionaryRef userInfo)
 typedef CF_NOTIFICATION_CALLBACK(cf_notification_callback);
 
+// the keyboard layout can only be read on the main thread. `keycode_from_char()` builds the map on first use, call
+// `prepare_keycode_map()` beforehand when parsing on another thread.
 bool initialize_keycode_map(void);
+bool prepare_keycode_map(void); // builds the map unless it already is
 uint32_t keycode_from_char(char key);
+// identifies the current keyboard layout (and with it, what `keycode_from_char()` returns).
+uint64_t keyboard_layout_fingerprint(void);
@@ -2,9 +2,11 @@
 
 #include <Carbon/Carbon.h>
 #include <CoreFoundation/CoreFoundation.h>
+#include <dispatch/dispatch.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <objc/objc-runtime.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -17,19 +19,24 @@
 #include <unistd.h>
 
 #include "carbon.h"
+#include "config_cache.h"
 #include "event_tap.h"
 #include "hashtable.h"
 #include "hotkey.h"
 #include "hotload.h"
+#include "image.h"
+#include "intern.h"
 #include "locale.h"
 #include "log.h"
 #include "notify.h"
 #include "parse.h"
 #include "sbuffer.h"
 #include "service.h"
+#include "spawn.h"
 #include "synthesize.h"
 #include "timing.h"
 #include "tokenize.h"
+#include "utils.h"
 
 #include "tr_malloc.h"
 
@@ -44,6 +51,8 @@ extern CGError CGSRegisterNotifyProc(void *handler, uint32_t type, void *context
 
 #define MKHD_CONFIG_FILE ".mkhdrc"
 #define MKHD_PIDFILE_FMT "/tmp/mkhd_%s.pid"
+#define MKHD_STATSFILE_FMT "/tmp/mkhd_%s.stats"
+#define MKHD_SNAPSHOT_FMT "%s.snapshot" // next to the config file
 
 #define VERSION_OPT_LONG "--version"
 
@@ -61,7 +70,7 @@ extern CGError CGSRegisterNotifyProc(void *handler, uint32_t type, void *context
 // pointers allocated within each context can be freed all at once
 // whenever appropriate. (see trmalloc.h for more)
 static struct trctx *memctx_global;
-static struct trctx *memctx_mstate;
+static struct trctx *memctx_config; // the config while it is built, see load_config()
 static struct trctx *memctx_event;
 
 static struct carbon_event carbon; // uses memctx_global
@@ -69,71 +78,327 @@ static struct event_tap event_tap;
 
 static char config_file[4096];
 static bool thwart_hotloader;
+static bool compile_snapshot;
 bool verbose;
 bool veryverbose;
 
-static struct mkhd_state *g_mstate = NULL;
-static struct hotloader hotloader; // uses memctx_mstate
+// a loaded config. everything it needs outside of its image is allocated in `memctx`.
+struct config_generation {
+	struct trctx *memctx;
+	struct mkhd_state *mstate; // NULL if the generation is not in use
+	struct config_image image;
+	char **sources; // the config file and every file it loads
+};
+
+// configs are double buffered. a reload builds the next generation next to the live one, which keeps serving key
+// events until the new config is complete and replaces it. if the new config has errors, the live one is kept.
+static struct config_generation generations[2];
+static int live_generation = -1;		   // index into `generations`, -1 until the first config is loaded
+static struct mkhd_state *g_mstate = NULL; // the live generation's config
+
+static struct hotloader hotloader;		 // uses the live generation's memctx
+static struct config_cache config_cache; // the cached files are children of memctx_config
 
 static void init_mstate(struct mkhd_state *mstate) {
-	table_init(&g_mstate->layer_map, 13, (table_hash_func)hash_string, (table_compare_func)compare_string);
-	table_init(&g_mstate->blocklst, 13, (table_hash_func)hash_string, (table_compare_func)compare_string);
-	table_init(&g_mstate->alias_map, 13, (table_hash_func)hash_string, (table_compare_func)compare_string);
+	// all three tables are keyed by interned strings.
+	table_init(&mstate->layer_map, 8, (table_hash_func)hash_interned, (table_compare_func)compare_interned);
+	table_init(&mstate->blocklst, 8, (table_hash_func)hash_interned, (table_compare_func)compare_interned);
+	table_init(&mstate->alias_map, 8, (table_hash_func)hash_interned, (table_compare_func)compare_interned);
+	mstate->options = (struct config_options){.max_jobs = 0, .retrigger = Retrigger_Default};
 
 	// initialize default layer.
-	struct layer *default_layer = create_new_layer(DEFAULT_LAYER);
+	struct layer *default_layer = create_new_layer(intern_string(DEFAULT_LAYER));
 	mstate->layerstack[0] = (struct layerstack_frame){
 		.l = default_layer,
 		.oneshot = false,
 	};
 	mstate->layerstack_cnt = 1;
-	table_add(&mstate->layer_map, DEFAULT_LAYER, default_layer);
+	table_add(&mstate->layer_map, default_layer->name, default_layer);
+}
+
+static void print_table_stats(const char *name, struct table *table) {
+	struct table_stats stats;
+	table_stats(table, &stats);
+	printf("  %-24s %5d/%-5d load %.2f  probe avg %.2f max %3d  |", name, stats.count, stats.capacity,
+		   stats.load_factor, stats.average_probe, stats.longest_probe);
+	for (int i = 0; i < TABLE_STATS_HISTOGRAM; ++i) {
+		printf(" %d", stats.histogram[i]);
+	}
+	printf("%s\n", table->frozen ? "  (frozen)" : "");
+}
+
+// makes hashing regressions (eg. every key landing in the same slot) visible under --profile.
+static void profile_config_tables(struct mkhd_state *mstate) {
+	printf("mkhd: hashtable stats (entries/capacity, probe length histogram 1..%d+, frozen tables count position "
+		   "within a hash group):\n",
+		   TABLE_STATS_HISTOGRAM);
+	print_table_stats("layer_map", &mstate->layer_map);
+	print_table_stats("blocklist", &mstate->blocklst);
+	print_table_stats("alias_map", &mstate->alias_map);
+
+	struct table_iter it = table_iter(&mstate->layer_map);
+	while (table_iter_next(&it)) {
+		struct layer *layer = it.value;
+		char name[64];
+		snprintf(name, sizeof(name), "|%s", layer->name);
+		print_table_stats(name, &layer->hotkey_map);
+	}
+}
+
+static void print_memory_stats(FILE *out) {
+	fprintf(out, "mkhd: memory stats (bytes requested by live objects, by tag):\n");
+	for (struct trctx *ctx = trctx_iter(NULL); ctx; ctx = trctx_iter(ctx)) {
+		struct trctx_stats stats;
+		trctx_stats(ctx, &stats);
+		fprintf(out, "  %-8s %9ld live in %6d objects  peak %9ld  reserved %9ld  %8lu allocations%s\n", stats.name,
+				stats.live_bytes, stats.live_objects, stats.peak_bytes, stats.reserved_bytes, stats.allocations,
+				stats.region ? "  (region)" : "");
+		for (int i = 0; i < stats.tag_count; ++i) {
+			if (stats.tags[i].live_objects == 0)
+				continue;
+			fprintf(out, "    %-10s %9ld in %6d objects\n", stats.tags[i].name, stats.tags[i].live_bytes,
+					stats.tags[i].live_objects);
+		}
+	}
+}
+
+// makes a table immutable for the lifetime of the loaded config.
+static void seal_table(struct table *table) {
+	if (!table_freeze(table)) {
+		debug("mkhd: could not build a perfect hash for a table (%d entries), keeping it mutable.\n", table->count);
+		table_shrink_to_fit(table);
+	}
 }
 
 static HOTLOADER_CALLBACK(config_handler);
 
-static void load_config(char *absolutepath) {
-	struct trctx *old_context = trctx_set_memcontext(memctx_mstate);
-	int objects_freed = trctx_free_everything(memctx_mstate);
+static void watch_config_sources(struct config_generation *generation) {
+	if (thwart_hotloader)
+		return;
+
+	hotloader_end(&hotloader);
+	// the old watch list belonged to the previous generation and is released with it.
+	hotloader.memctx = generation->memctx;
+	for (int i = 0; i < buf_len(generation->sources); ++i) {
+		hotloader_add_file(&hotloader, generation->sources[i]);
+	}
+	if (hotloader_begin(&hotloader, config_handler)) {
+		debug("mkhd: watching files for changes:\n");
+		hotloader_debug(&hotloader);
+	} else {
+		warn("mkhd: could not start watcher.. hotloading is not "
+			 "enabled\n");
+	}
+}
+
+// links the config into memctx_config and moves it into the generation's image. only the files that changed since the
+// last load are parsed again, see config_cache.h.
+// `errors` is set if the config could not be read or had errors. (whatever could be parsed is still in the image)
+// returns false if there is no image.
+static bool parse_config_file(struct config_generation *generation, char *absolutepath, uint64_t seed, bool *errors) {
+	struct mkhd_state *mstate = generation->mstate;
+	trctx_set_memcontext(memctx_config);
+	init_mstate(mstate);
+
+	char **sources = NULL;
+	prepare_keycode_map();
+	*errors = !config_cache_link(&config_cache, mstate, absolutepath, seed, &sources);
+
+	// tables are read-only from here on. freeze them and compile the layers' dispatch arrays.
+	struct table_iter it = table_iter(&mstate->layer_map);
+	while (table_iter_next(&it)) {
+		struct layer *layer = it.value;
+		seal_table(&layer->hotkey_map);
+		compile_layer_dispatch(layer);
+	}
+	seal_table(&mstate->layer_map);
+	seal_table(&mstate->blocklst);
+	seal_table(&mstate->alias_map);
+
+	trctx_set_memcontext(generation->memctx);
+	for (int i = 0; i < buf_len(sources); ++i) {
+		buf_push(generation->sources, copy_string_malloc(sources[i]));
+	}
+
+	bool result = config_image_build(&generation->image, mstate, memctx_config);
+	if (result) {
+		debug("mkhd: config image is %zu bytes (%d pointers).\n", generation->image.size,
+			  generation->image.relocation_count);
+	} else {
+		warn("mkhd: could not build config image.\n");
+	}
+	// the image is a copy, nothing refers to memctx_config anymore.
+	trctx_free_everything(memctx_config);
+	return result;
+}
+
+static void release_generation(struct config_generation *generation) {
+	forget_waiting_macros(generation->mstate);
+	spawn_forget_config(generation->mstate);
+	config_image_release(&generation->image);
+	int objects_freed = trctx_free_everything(generation->memctx);
 	if (objects_freed != 0)
 		debug("mkhd: (config load) freed %d objects on old config.\n", objects_freed);
+	generation->mstate = NULL;
+	generation->sources = NULL;
+}
 
-	// everything within `g_mstate` will be tracked by tr_malloc within memctx_mstate (including the g_state object
-	// itseft).
-	g_mstate = tr_malloc(sizeof(struct mkhd_state));
-	init_mstate(g_mstate);
+// builds `next` from the snapshot written by `mkhd --compile` if the config did not change since, parses the config
+// otherwise. safe to run on a worker thread: it only allocates in `next->memctx` and memctx_config, and the keycode map
+// must already be there (see `prepare_keycode_map()`).
+// returns false if the config could not be loaded or had errors. `replace` is set if `next` should replace the live
+// config, which is only the case if it loaded without errors. (or if there is no live config yet, then even a partial
+// one is better than nothing)
+static bool build_config(struct config_generation *next, char *absolutepath, uint64_t seed, bool *replace) {
+	struct trctx *old_context = trctx_set_memcontext(next->memctx);
+	next->mstate = tr_malloc(sizeof(struct mkhd_state));
+
+	bool errors = false;
+	bool loaded;
+	char snapshot_file[4096 + 16];
+	snprintf(snapshot_file, sizeof(snapshot_file), MKHD_SNAPSHOT_FMT, absolutepath);
+	if (!compile_snapshot && config_image_load(&next->image, next->mstate, snapshot_file, seed, &next->sources)) {
+		debug("mkhd: using snapshot '%s' (%zu bytes, %zu files).\n", snapshot_file, next->image.size,
+			  buf_len(next->sources));
+		loaded = true;
+	} else {
+		loaded = parse_config_file(next, absolutepath, seed, &errors);
+	}
+	if (!loaded && live_generation < 0) {
+		// nothing to fall back to. run with an empty config rather than none.
+		trctx_set_memcontext(next->memctx);
+		init_mstate(next->mstate);
+	}
+	trctx_set_memcontext(old_context);
+	*replace = live_generation < 0 || (loaded && !errors);
+	return loaded && !errors;
+}
 
-	struct parser parser;
-	if (parser_init(&parser, &g_mstate->layer_map, &g_mstate->blocklst, &g_mstate->alias_map, absolutepath)) {
-		if (!thwart_hotloader) {
-			hotloader_end(&hotloader);
-			hotloader_add_file(&hotloader, absolutepath);
-		}
+// makes `next` the config key events are dispatched to. the event tap reads `g_mstate` once per event, the image and
+// state it points to are complete before the pointer is.
+static void publish_config(struct config_generation *next) {
+	__atomic_store_n(&g_mstate, next->mstate, __ATOMIC_RELEASE);
+}
 
-		if (parse_config(&parser)) {
-			// todo: eliminate this.
-			parser_do_directives(&parser, &hotloader, thwart_hotloader);
-		}
-		parser_destroy(&parser);
-
-		if (!thwart_hotloader) {
-			if (hotloader_begin(&hotloader, config_handler)) {
-				debug("mkhd: watching files for changes:\n", absolutepath);
-				hotloader_debug(&hotloader);
-			} else {
-				warn("mkhd: could not start watcher.. hotloading is not "
-					 "enabled\n");
-			}
-		}
-	} else {
-		warn("mkhd: could not open file '%s'\n", absolutepath);
+// main thread only, after `next` was built and, if `replace`, published.
+// key events are only dispatched on the main thread, so by the time this runs no event is still using the previous
+// generation and it can be released.
+static void install_config(struct config_generation *next, bool replace) {
+	struct trctx *old_context = trctx_set_memcontext(next->memctx);
+	if (!replace) {
+		warn("mkhd: the new config has errors, keeping the current one.\n");
+		release_generation(next);
+		trctx_set_memcontext(old_context);
+		return;
+	}
+
+	struct config_generation *previous = live_generation >= 0 ? &generations[live_generation] : NULL;
+	live_generation = next - generations;
+	watch_config_sources(next);
+	spawn_set_max_jobs(next->mstate->options.max_jobs);
+	if (previous)
+		release_generation(previous);
+
+	debug("mkhd: allocated %d objects on config load.\n", trctx_reclaim_empty_slots(next->memctx));
+	if (profile) {
+		profile_config_tables(next->mstate);
+		print_memory_stats(stdout);
 	}
-	int objects_survived = trctx_reclaim_empty_slots(memctx_mstate);
-	debug("mkhd: allocated %d objects on config load.\n", objects_survived);
 	trctx_set_memcontext(old_context);
 }
 
-static void reload_config() { load_config(config_file); }
+static struct config_generation *spare_generation(void) { return &generations[live_generation == 0 ? 1 : 0]; }
+
+// what a parsed config depends on besides its files. it is part of every cached fragment's key and of the snapshot's
+// fingerprint, so a snapshot compiled in another environment is not used. only safe on the main thread.
+static uint64_t config_seed(void) {
+	uint64_t seed = keyboard_layout_fingerprint();
+	// macro commands are merged into one script for a posix shell only, see `merge_macro_commands()`.
+	bool posix_shell = spawn_shell_is_posix();
+	seed = hash_bytes(seed, &posix_shell, sizeof(posix_shell));
+	// programs run without a shell are looked up in PATH when parsing, see `parse_exec_command()`.
+	const char *path = getenv("PATH");
+	return path ? hash_bytes(seed, path, strlen(path) + 1) : seed;
+}
+
+// loads the config right away, used on startup and by `mkhd --compile`.
+static bool load_config(char *absolutepath) {
+	struct config_generation *next = spare_generation();
+	bool replace;
+	bool result = build_config(next, absolutepath, config_seed(), &replace);
+	if (replace)
+		publish_config(next);
+	install_config(next, replace);
+	return result;
+}
+
+// reloads build the next generation on a worker thread, so a big config doesn't hold up key events (and get the event
+// tap disabled by timeout). one reload runs at a time, requests that come in meanwhile are merged into one that
+// starts once it is done.
+static struct {
+	pthread_t thread;
+	bool running;
+	bool pending;
+	bool keymap_changed;  // rebuild the keycode map before the next reload. (not while a worker may be using it)
+	bool stats_requested; // see `sigusr2_handler()`
+	struct config_generation *next;
+	uint64_t seed;
+	bool replace;
+} reloader;
+
+static void write_stats_file(void);
+static void reload_config(void);
+
+static void reload_finished(void *context) {
+	pthread_join(reloader.thread, NULL);
+	install_config(reloader.next, reloader.replace);
+	reloader.running = false;
+
+	if (reloader.stats_requested) {
+		reloader.stats_requested = false;
+		write_stats_file();
+	}
+	if (reloader.pending) {
+		reloader.pending = false;
+		reload_config();
+	}
+}
+
+static void *reload_worker(void *context) {
+	// signals are handled on the main thread.
+	sigset_t signals;
+	sigfillset(&signals);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	build_config(reloader.next, config_file, reloader.seed, &reloader.replace);
+	if (reloader.replace)
+		publish_config(reloader.next);
+	dispatch_async_f(dispatch_get_main_queue(), NULL, reload_finished);
+	return NULL;
+}
+
+static void reload_config(void) {
+	if (reloader.running) {
+		reloader.pending = true;
+		return;
+	}
+	if (reloader.keymap_changed) {
+		reloader.keymap_changed = false;
+		if (!initialize_keycode_map())
+			warn("mkhd: could not initialize keycode map!\n");
+	}
+
+	// the keyboard layout can only be read on this thread.
+	prepare_keycode_map();
+	reloader.seed = config_seed();
+	reloader.next = spare_generation();
+	reloader.running = true;
+	if (pthread_create(&reloader.thread, NULL, reload_worker, NULL) != 0) {
+		warn("mkhd: could not start a thread to reload the config, reloading right away.\n");
+		reloader.running = false;
+		load_config(config_file);
+	}
+}
 
 static HOTLOADER_CALLBACK(config_handler) {
 	BEGIN_TIMED_BLOCK("hotload_config");
@@ -145,10 +410,9 @@ static HOTLOADER_CALLBACK(config_handler) {
 
 static CF_NOTIFICATION_CALLBACK(keymap_handler) {
 	BEGIN_TIMED_BLOCK("keymap_changed");
-	if (initialize_keycode_map()) {
-		debug("mkhd: input source changed.. reloading config\n");
-		reload_config();
-	}
+	debug("mkhd: input source changed.. reloading config\n");
+	reloader.keymap_changed = true;
+	reload_config();
 	END_TIMED_BLOCK();
 }
 
@@ -189,7 +453,7 @@ static inline bool keydown_keyevent_correspond(struct keyevent *a, struct keyeve
 	return a->key == b->key && (a->flags & Hotkey_Flag_NX) == (b->flags & Hotkey_Flag_NX);
 }
 
-static bool process_keydown(struct keyevent eventkey) {
+static bool process_keydown(struct mkhd_state *mstate, struct keyevent eventkey) {
 	// check if key is already in keydown state, if it is, ignore.
 	for (int i = 0; i < MAX_KEYDOWN; i++) {
 		if (keydown_keys[i].type != Event_Null && keydown_keyevent_correspond(&keydown_keys[i], &eventkey)) {
@@ -198,7 +462,7 @@ static bool process_keydown(struct keyevent eventkey) {
 	}
 	// try to process as @keydown first
 	eventkey.type = Event_KeyDown;
-	bool result = find_and_exec_keyevent(g_mstate, &eventkey, carbon.process_name);
+	bool result = find_and_exec_keyevent(mstate, &eventkey, carbon.process_name);
 	if (result) {
 		// record key as in "down" state
 		bool found_slot = false;
@@ -216,11 +480,11 @@ static bool process_keydown(struct keyevent eventkey) {
 	} else {
 		// if a @keydown binding is not set, process as normal key.
 		eventkey.type = Event_Key;
-		return find_and_exec_keyevent(g_mstate, &eventkey, carbon.process_name);
+		return find_and_exec_keyevent(mstate, &eventkey, carbon.process_name);
 	}
 }
 
-static bool process_keyup(struct keyevent eventkey) {
+static bool process_keyup(struct mkhd_state *mstate, struct keyevent eventkey) {
 	bool found = false;
 	for (int i = 0; i < MAX_KEYDOWN; i++) {
 		// clear keydown state for the key
@@ -236,7 +500,7 @@ static bool process_keyup(struct keyevent eventkey) {
 	if (found) {
 
 		eventkey.type = Event_KeyUp;
-		return find_and_exec_keyevent(g_mstate, &eventkey, carbon.process_name);
+		return find_and_exec_keyevent(mstate, &eventkey, carbon.process_name);
 	}
 	return false;
 }
@@ -244,6 +508,8 @@ static bool process_keyup(struct keyevent eventkey) {
 void mkhd_event_tap_set_enabled(bool enabled) { CGEventTapEnable(event_tap.handle, enabled); }
 
 static EVENT_TAP_CALLBACK(key_handler_impl) {
+	// the config may be replaced by a reload at any time, handle the whole event with the same one.
+	struct mkhd_state *mstate = __atomic_load_n(&g_mstate, __ATOMIC_ACQUIRE);
 	switch (type) {
 	case kCGEventTapDisabledByTimeout:
 	case kCGEventTapDisabledByUserInput: {
@@ -252,38 +518,38 @@ static EVENT_TAP_CALLBACK(key_handler_impl) {
 		CGEventTapEnable(event_tap->handle, 1);
 	} break;
 	case kCGEventKeyDown: {
-		if (table_find(&g_mstate->blocklst, carbon.process_name))
+		if (table_find(&mstate->blocklst, carbon.process_name))
 			return event;
 
 		BEGIN_TIMED_BLOCK("handle_keydown");
-		bool result = process_keydown(create_keyevent_from_CGEvent(event));
+		bool result = process_keydown(mstate, create_keyevent_from_CGEvent(event));
 		END_TIMED_BLOCK();
 
 		if (result)
 			return NULL;
 	} break;
 	case kCGEventKeyUp: {
-		if (table_find(&g_mstate->blocklst, carbon.process_name))
+		if (table_find(&mstate->blocklst, carbon.process_name))
 			return event;
 
 		BEGIN_TIMED_BLOCK("handle_keyup");
-		bool result = process_keyup(create_keyevent_from_CGEvent(event));
+		bool result = process_keyup(mstate, create_keyevent_from_CGEvent(event));
 		END_TIMED_BLOCK();
 
 		if (result)
 			return NULL;
 	} break;
 	case NX_SYSDEFINED: {
-		if (table_find(&g_mstate->blocklst, carbon.process_name))
+		if (table_find(&mstate->blocklst, carbon.process_name))
 			return event;
 
 		struct keyevent eventkey;
 		if (intercept_systemkey(event, &eventkey)) {
 			bool result = false;
 			if (eventkey.type == Event_KeyDown)
-				result = process_keydown(eventkey);
+				result = process_keydown(mstate, eventkey);
 			else if (eventkey.type == Event_KeyUp)
-				result = process_keyup(eventkey);
+				result = process_keyup(mstate, eventkey);
 			if (result)
 				return NULL;
 		}
@@ -295,18 +561,78 @@ static EVENT_TAP_CALLBACK(key_handler_impl) {
 static EVENT_TAP_CALLBACK(key_handler) {
 	trctx_set_memcontext(memctx_event);
 	CGEventRef res = key_handler_impl(proxy, type, event, reference);
-	trctx_free_everything(memctx_event);
+	trctx_free_everything(memctx_event); // returns right away unless something was allocated
 	trctx_set_memcontext(memctx_global);
 	return res;
 }
 
-static void sigusr1_handler(int signal) {
+// signals are delivered through dispatch sources on the main queue, see `handle_signal()`. so these run like any
+// other main thread callback, and not in the middle of one.
+static void sigusr1_handler(void *context) {
 	BEGIN_TIMED_BLOCK("sigusr1");
 	debug("mkhd: SIGUSR1 received.. reloading config\n");
 	reload_config();
 	END_TIMED_BLOCK();
 }
 
+static bool get_stats_file(char *buffer, int buffer_size) {
+	char *user = getenv("USER");
+	if (!user)
+		return false;
+	snprintf(buffer, buffer_size, MKHD_STATSFILE_FMT, user);
+	return true;
+}
+
+// `mkhd --stats` asks the running instance for its memory stats through SIGUSR2.
+// they are written to a temporary file first and then renamed, so the reader never sees a partial file. /tmp is shared,
+// so the temporary file is created by `mkstemp()`: a new file only we can write, never a link someone else left there.
+static void write_stats_file(void) {
+	char stats_file[255];
+	char temp_file[255 + 8];
+	if (!get_stats_file(stats_file, sizeof(stats_file))) {
+		warn("mkhd: could not create path to stats-file because 'env USER' was not set!\n");
+		return;
+	}
+	snprintf(temp_file, sizeof(temp_file), "%s.XXXXXX", stats_file);
+
+	int handle = mkstemp(temp_file);
+	FILE *out = handle == -1 ? NULL : fdopen(handle, "w");
+	if (!out) {
+		warn("mkhd: could not write stats-file '%s'\n", temp_file);
+		if (handle != -1) {
+			close(handle);
+			unlink(temp_file);
+		}
+		return;
+	}
+	print_memory_stats(out);
+	spawn_print_stats(out);
+	fclose(out);
+	if (rename(temp_file, stats_file) == -1) {
+		warn("mkhd: could not write stats-file '%s'\n", stats_file);
+		unlink(temp_file);
+	}
+}
+
+static void sigusr2_handler(void *context) {
+	debug("mkhd: SIGUSR2 received.. writing memory stats\n");
+	// a reload creates and destroys memory contexts, wait for it to finish before listing them.
+	if (reloader.running)
+		reloader.stats_requested = true;
+	else
+		write_stats_file();
+}
+
+static void handle_signal(int signal_number, dispatch_function_t handler) {
+	// the source still sees ignored signals, ignoring them only keeps the default action (terminate) from happening.
+	// children inherit the ignored disposition, `spawn.c` resets it for everything it starts.
+	signal(signal_number, SIG_IGN);
+	dispatch_source_t source =
+		dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, signal_number, 0, dispatch_get_main_queue());
+	dispatch_source_set_event_handler_f(source, handler);
+	dispatch_resume(source); // lives as long as the process
+}
+
 static pid_t read_pid_file(void) {
 	char pid_file[255] = {};
 	pid_t pid = 0;
@@ -365,6 +691,62 @@ static void create_pid_file(void) {
 	debug("mkhd: successfully created pid-file..\n");
 }
 
+static void print_running_instance_stats(void) {
+	char stats_file[255];
+	if (!get_stats_file(stats_file, sizeof(stats_file))) {
+		error("mkhd: could not create path to stats-file because 'env USER' was "
+			  "not set! abort..\n");
+	}
+
+	// kill(0, ..) would signal the whole process group, this one included.
+	pid_t pid = read_pid_file();
+	if (!pid) {
+		error("mkhd: no running instance! abort..\n");
+	}
+	unlink(stats_file);
+	kill(pid, SIGUSR2);
+
+	// give the running instance up to a second to answer.
+	FILE *handle = NULL;
+	for (int i = 0; i < 100 && !(handle = fopen(stats_file, "r")); ++i) {
+		usleep(10000);
+	}
+	if (!handle) {
+		error("mkhd: running instance did not respond..\n");
+	}
+
+	char buffer[4096];
+	size_t length;
+	while ((length = fread(buffer, 1, sizeof(buffer), handle)) > 0) {
+		fwrite(buffer, 1, length, stdout);
+	}
+	fclose(handle);
+}
+
+static bool get_config_file(char *restrict filename, char *restrict buffer, int buffer_size);
+
+// `mkhd --compile` parses the config once and writes it to a snapshot that later starts map instead of parsing.
+static void compile_config(void) {
+	if (config_file[0] == 0) {
+		get_config_file("mkhdrc", config_file, sizeof(config_file));
+	}
+	thwart_hotloader = true;
+	compile_snapshot = true;
+	init_shell(); // part of the seed, see `config_seed()`
+
+	if (!load_config(config_file)) {
+		error("mkhd: could not compile config '%s'! abort..\n", config_file);
+	}
+	char snapshot_file[4096 + 16];
+	snprintf(snapshot_file, sizeof(snapshot_file), MKHD_SNAPSHOT_FMT, config_file);
+	struct config_generation *generation = &generations[live_generation];
+	if (!config_image_write(&generation->image, snapshot_file, generation->sources, config_seed())) {
+		error("mkhd: could not write snapshot '%s'! abort..\n", snapshot_file);
+	}
+	printf("mkhd: compiled %zu files into '%s' (%zu bytes)\n", buf_len(generation->sources), snapshot_file,
+		   generation->image.size);
+}
+
 static inline bool string_equals(const char *a, const char *b) { return a && b && strcmp(a, b) == 0; }
 
 static bool parse_arguments(int argc, char **argv) {
@@ -394,12 +776,13 @@ static bool parse_arguments(int argc, char **argv) {
 	}
 
 	int option;
-	const char *short_option = "VPvc:k:t:rho";
+	const char *short_option = "VPvc:k:t:rhosC";
 	struct option long_option[] = {{"verbose", no_argument, NULL, 'v'},	   {"veryverbose", no_argument, NULL, 'V'},
 								   {"profile", no_argument, NULL, 'P'},	   {"config", required_argument, NULL, 'c'},
 								   {"no-hotload", no_argument, NULL, 'h'}, {"key", required_argument, NULL, 'k'},
 								   {"text", required_argument, NULL, 't'}, {"reload", no_argument, NULL, 'r'},
-								   {"observe", no_argument, NULL, 'o'},	   {NULL, 0, NULL, 0}};
+								   {"observe", no_argument, NULL, 'o'},	   {"stats", no_argument, NULL, 's'},
+								   {"compile", no_argument, NULL, 'C'},	   {NULL, 0, NULL, 0}};
 
 	while ((option = getopt_long(argc, argv, short_option, long_option, NULL)) != -1) {
 		switch (option) {
@@ -435,14 +818,27 @@ static bool parse_arguments(int argc, char **argv) {
 				kill(pid, SIGUSR1);
 			return true;
 		} break;
+		case 's': {
+			print_running_instance_stats();
+			return true;
+		} break;
 		case 'o': {
 			event_tap.mask = (1 << kCGEventKeyDown) | (1 << kCGEventFlagsChanged);
 			event_tap_begin(&event_tap, key_observer_handler);
 			CFRunLoopRun();
 		} break;
+		case 'C': {
+			compile_snapshot = true;
+		} break;
 		}
 	}
 
+	// after all options, -c may come after --compile.
+	if (compile_snapshot) {
+		compile_config();
+		return true;
+	}
+
 	return false;
 }
 
@@ -524,9 +920,13 @@ static void dump_secure_keyboard_entry_process_info(void) {
 
 int main(int argc, char **argv) {
 
-	memctx_global = trctx_new_context();
-	memctx_mstate = trctx_new_context();
-	memctx_event = trctx_new_context();
+	memctx_global = trctx_new_context("global");
+	generations[0].memctx = trctx_new_region("mstate.0");
+	generations[1].memctx = trctx_new_region("mstate.1");
+	memctx_config = trctx_new_region("config");
+	memctx_event = trctx_new_region("event");
+	config_cache.memctx = trctx_new_context("cache");
+	config_cache.owner = memctx_config;
 
 	trctx_set_memcontext(memctx_global);
 
@@ -554,10 +954,6 @@ int main(int argc, char **argv) {
 			require("mkhd: must be run with accessibility access!\n");
 	}
 
-	if (!initialize_keycode_map()) {
-		error("mkhd: could not initialize keycode map! abort..\n");
-	}
-
 	if (!carbon_event_init(&carbon)) {
 		error("mkhd: could not initialize carbon events! abort..\n");
 	}
@@ -570,10 +966,11 @@ int main(int argc, char **argv) {
 									kTISNotifySelectedKeyboardInputSourceChanged, NULL,
 									CFNotificationSuspensionBehaviorCoalesce);
 
-	signal(SIGCHLD, SIG_IGN);
-	signal(SIGUSR1, sigusr1_handler);
+	handle_signal(SIGUSR1, sigusr1_handler);
+	handle_signal(SIGUSR2, sigusr2_handler);
 
 	init_shell();
+	spawn_init();
 
 	END_SCOPED_TIMED_BLOCK();
 
@@ -7,10 +7,17 @@
 
 #define LAYERSTACK_MAX 5
 
+// set by options anywhere in the config. the last one wins.
+struct config_options {
+	int max_jobs;	   // commands that run at the same time, 0 for no limit. (-1 in a file that does not set it)
+	uint8_t retrigger; // enum retrigger, of the commands bound without one
+};
+
 struct mkhd_state {
 	struct table layer_map;
 	struct table blocklst;
 	struct table alias_map;
+	struct config_options options;
 
 	// keeps track of the history of `|>` layer switches.
 	// persists between key presses.
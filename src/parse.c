@@ -1,25 +1,30 @@
 #include "parse.h"
 
 #include <IOKit/hidsystem/ev_keymap.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "hashtable.h"
 #include "hotkey.h"
+#include "intern.h"
 #include "locale.h"
 #include "log.h"
 #include "mkhd.h"
 #include "sbuffer.h"
+#include "spawn.h"
 #include "tokenize.h"
 #include "utils.h"
 
-#define DEFVAR_FROM_TOKEN_TEXT(var, token)                                                                             \
-	char(var)[(token).length + 1];                                                                                     \
-	copy_string_count_nomalloc((var), (token).text, (token).length);
-
+// `name` must be interned.
 static struct layer *find_layer_or_create(struct parser *parser, const char *name) {
 	struct layer *layer = table_find(parser->layer_map, name);
 
@@ -34,22 +39,278 @@ static struct layer *find_layer_or_create(struct parser *parser, const char *nam
 	return layer;
 }
 
-static char *read_file(const char *file) {
-	unsigned length;
-	char *buffer = NULL;
-	FILE *handle = fopen(file, "r");
+// process names are matched in lower case. most are written that way and are interned straight from the file.
+static const char *intern_lowercase(struct token token) {
+	int i = 0;
+	while (i < token.length && !isupper((unsigned char)token.text[i]))
+		++i;
+	if (i == token.length)
+		return intern_string_count(token.text, token.length);
+
+	char lowercase[token.length];
+	for (i = 0; i < token.length; ++i)
+		lowercase[i] = tolower((unsigned char)token.text[i]);
+	return intern_string_count(lowercase, token.length);
+}
+
+// only resolved in verbose mode, the lines are counted on demand.
+static unsigned token_line(struct parser *parser, struct token token) {
+	return verbose ? tokenizer_position(&parser->tokenizer, token).line : 0;
+}
+
+bool parser_read_file(const char *file, struct source_file *source) {
+	int fd = open(file, O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+		close(fd);
+		return false;
+	}
+
+	// the size is only what to expect. an editor may be rewriting the file right now, what is read is what counts.
+	char *text = tr_malloc_tag(info.st_size + 1, "parser");
+	size_t length = 0;
+	while (length < info.st_size) {
+		ssize_t count = read(fd, text + length, info.st_size - length);
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+			tr_free(text);
+			close(fd);
+			return false;
+		}
+		if (count == 0)
+			break;
+		length += count;
+	}
+	close(fd);
+	*source = (struct source_file){.text = text, .length = length};
+	return true;
+}
+
+void parser_free_file(struct source_file *source) {
+	tr_free(source->text);
+	*source = (struct source_file){0};
+}
+
+// characters that mean nothing to a shell outside of quotes. (any UTF-8 too)
+static bool is_plain_char(char c) {
+	return isalnum((unsigned char)c) || (unsigned char)c >= 0x80 || (c && strchr("-_./:,+@%=", c));
+}
+
+// whether `command` is nothing but words of plain characters and quoted strings that nothing is expanded in, which a
+// shell would run the same as splitting it into words and running the program.
+static bool is_plain_command(const char *command) {
+	int word = -1;
+	bool in_word = false;
+	for (const char *c = command; *c; ++c) {
+		if (*c == ' ' || *c == '\t') {
+			in_word = false;
+			continue;
+		}
+		if (!in_word) {
+			word++;
+			in_word = true;
+			if (*c == '=') // `=program` is its path in zsh
+				return false;
+		}
+		if (*c == '\'') {
+			c = strchr(c + 1, '\'');
+			if (c == NULL)
+				return false;
+		} else if (*c == '"') {
+			do {
+				++c;
+				if (*c == '\0' || strchr("$`\\!", *c))
+					return false;
+			} while (*c != '"');
+		} else if (!is_plain_char(*c) || (*c == '=' && word == 0)) {
+			// `name=value program` sets a variable.
+			return false;
+		}
+	}
+	return word >= 0;
+}
+
+// splits a plain command into its words, removing the quotes. they are written to `strings`, which is as long as the
+// command.
+static char **split_command(const char *command, char *strings) {
+	char **argv = NULL;
+	char *at = strings;
+	bool in_word = false;
+	for (const char *c = command; *c; ++c) {
+		if (*c == ' ' || *c == '\t') {
+			if (in_word)
+				*at++ = '\0';
+			in_word = false;
+			continue;
+		}
+		if (!in_word) {
+			buf_push(argv, at);
+			in_word = true;
+		}
+		if (*c == '\'' || *c == '"') {
+			const char *close = strchr(c + 1, *c);
+			memcpy(at, c + 1, close - c - 1);
+			at += close - c - 1;
+			c = close;
+		} else {
+			*at++ = *c;
+		}
+	}
+	*at = '\0';
+	buf_push(argv, NULL);
+	return argv;
+}
+
+// builtins and keywords. they are run by the shell even if there is a program of the same name.
+static const char *shell_words[] = {
+	".", ":", "[", "alias", "bg", "bind", "break", "builtin", "case", "cd", "command", "continue", "coproc", "declare",
+	"dirs", "disown", "do", "done", "echo", "elif", "else", "enable", "esac", "eval", "exec", "exit", "export", "false",
+	"fc", "fg", "fi", "for", "function", "getopts", "hash", "if", "jobs", "kill", "let", "local", "noglob", "popd",
+	"printf", "pushd", "pwd", "read", "readonly", "return", "select", "set", "setopt", "shift", "source", "test",
+	"then", "time", "times", "trap", "true", "type", "typeset", "ulimit", "umask", "unalias", "unset", "until", "wait",
+	"whence", "where", "which", "while",
+};
+
+static bool is_shell_word(const char *word) {
+	for (int i = 0; i < array_count(shell_words); ++i) {
+		if (strcmp(word, shell_words[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+// commands that are only a program and its arguments are split here, and run without a shell. NULL if `command` needs
+// one, or if its program is not in PATH. (the shell reports that when it is run)
+static struct exec_command *parse_exec_command(const char *command, int length) {
+	if (!is_plain_command(command))
+		return NULL;
+
+	char *strings = tr_malloc_tag(length + 1, "strings");
+	char **argv = split_command(command, strings);
+	char path[PATH_MAX];
+	if (is_shell_word(argv[0]) || !spawn_find_program(argv[0], path, sizeof(path))) {
+		buf_free(argv);
+		tr_free(strings);
+		return NULL;
+	}
+
+	struct exec_command *exec = tr_pool_alloc(sizeof(struct exec_command), "actions");
+	*exec = (struct exec_command){
+		.command = command,
+		.path = strcmp(path, argv[0]) == 0 ? argv[0] : copy_string_count_pooled(path, strlen(path)),
+		.argv = argv,
+	};
+	return exec;
+}
+
+// appends `(eval 'command')` to the sbuffer `script`, with the command's single quotes escaped. the shell parses each
+// command of a script like this on its own, and runs it in a subshell that can not change the others' state. the last
+// one needs no subshell of its own.
+static void append_eval(char **script, const char *command, bool last) {
+	for (const char *c = last ? "eval '" : "(eval '"; *c; ++c)
+		buf_push(*script, *c);
+	for (const char *c = command; *c; ++c) {
+		if (*c == '\'') {
+			for (const char *e = "'\\''"; *e; ++e)
+				buf_push(*script, *e);
+		} else {
+			buf_push(*script, *c);
+		}
+	}
+	for (const char *c = last ? "'\n" : "')\n"; *c; ++c)
+		buf_push(*script, *c);
+}
+
+// merges every run of consecutive shell commands in `macro` into a single command, a script that runs them one after
+// the other. the macro waited for each of them to exit before starting the next, the script does the same with one
+// spawn. any other action ends a run, Exec ones too: they are started directly, which is cheaper than from a script.
+static void merge_macro_commands(struct action *macro) {
+	if (!spawn_shell_is_posix())
+		return;
+
+	struct action **actions = macro->argument.actions;
+	int kept = 0;
+	for (int i = 0; i < buf_len(actions);) {
+		int end = i;
+		while (end < buf_len(actions) && actions[end]->type == Action_Command)
+			end++;
+		if (end - i < 2) {
+			actions[kept++] = actions[i++];
+			continue;
+		}
+
+		char *script = NULL;
+		for (int j = i; j < end; ++j)
+			append_eval(&script, actions[j]->argument.str, j == end - 1);
+		struct action *merged = actions[i];
+		merged->argument.str = copy_string_count_pooled(script, buf_len(script));
+		buf_free(script);
+		debug("\tmerged %d commands of the macro into:\n%s", end - i, merged->argument.str);
+
+		actions[kept++] = merged;
+		i = end;
+	}
+	if (actions)
+		buf__hdr(actions)->len = kept;
+}
+
+static const char *retrigger_names[] = {
+	[Retrigger_Queue] = "queue",
+	[Retrigger_Coalesce] = "coalesce",
+	[Retrigger_Drop] = "drop",
+};
+
+static enum retrigger parse_retrigger(struct parser *parser) {
+	if (parser_match(parser, Token_Identifier)) {
+		struct token token = parser_previous(parser);
+		for (int i = Retrigger_Queue; i < array_count(retrigger_names); ++i) {
+			if (token_equals(token, retrigger_names[i]))
+				return i;
+		}
+		parser_report_error(parser, token, "expected queue, coalesce or drop\n");
+	} else {
+		parser_report_error(parser, parser_peek(parser), "expected queue, coalesce or drop\n");
+	}
+	return Retrigger_Default;
+}
+
+// a decimal number. the tokenizer makes a key of every digit, the adjacent ones are put back together here.
+static bool parse_number(struct parser *parser, int *number) {
+	if (!parser_check(parser, Token_Key) || !isdigit((unsigned char)*parser_peek(parser).text))
+		return false;
+	struct token digit = parser_advance(parser);
+	int value = *digit.text - '0';
+	while (parser_check(parser, Token_Key) && parser_peek(parser).text == digit.text + 1 &&
+		   isdigit((unsigned char)*parser_peek(parser).text) && value < 1000000) {
+		digit = parser_advance(parser);
+		value = value * 10 + (*digit.text - '0');
+	}
+	*number = value;
+	return true;
+}
+
+static struct action *parse_action(struct parser *parser);
 
-	if (handle) {
-		fseek(handle, 0, SEEK_END);
-		length = ftell(handle);
-		fseek(handle, 0, SEEK_SET);
-		buffer = tr_malloc(length + 1);
-		fread(buffer, length, 1, handle);
-		buffer[length] = '\0';
-		fclose(handle);
+// `.retrigger <policy> : command`
+static struct action *parse_retrigger_action(struct parser *parser) {
+	enum retrigger retrigger = parse_retrigger(parser);
+	if (!parser->error && !parser_match(parser, Token_Command))
+		parser_report_error(parser, parser_peek(parser), "expected command\n");
+	if (parser->error) {
+		struct action *action = tr_pool_alloc(sizeof(struct action), "actions");
+		memset(action, 0, sizeof(struct action));
+		return action;
 	}
 
-	return buffer;
+	struct action *action = parse_action(parser);
+	action->retrigger = retrigger;
+	debug("\t\tretrigger: %s\n", retrigger_names[retrigger]);
+	return action;
 }
 
 static bool parser_match_action(struct parser *parser) {
@@ -58,16 +319,27 @@ static bool parser_match_action(struct parser *parser) {
 
 static struct action *parse_action(struct parser *parser) {
 	struct token token = parser_previous(parser);
-	struct action *action = tr_malloc(sizeof(struct action));
+	if (token.type == Token_Option && token_equals(token, "retrigger"))
+		return parse_retrigger_action(parser);
+
+	struct action *action = tr_pool_alloc(sizeof(struct action), "actions");
 	memset(action, 0, sizeof(struct action));
 	action->type = Action_NoOp;
 
 	debug("\taction: ");
 
 	if (token.type == Token_Command) {
-		action->type = Action_Command;
-		action->argument.str = copy_string_count_malloc(token.text, token.length);
-		debug("[cmd]: '%s'\n", action->argument.str);
+		const char *command = copy_string_count_pooled(token.text, token.length);
+		struct exec_command *exec = parse_exec_command(command, token.length);
+		if (exec) {
+			action->type = Action_Exec;
+			action->argument.exec = exec;
+			debug("[exec]: %s '%s'\n", exec->path, command);
+		} else {
+			action->type = Action_Command;
+			action->argument.str = command;
+			debug("[cmd]: '%s'\n", command);
+		}
 	} else if (token.type == Token_Option) {
 		static struct {
 			const char *option;
@@ -83,9 +355,8 @@ static struct action *parse_action(struct parser *parser) {
 			{"resume", Action_Resume},
 		};
 
-		DEFVAR_FROM_TOKEN_TEXT(option, token);
 		for (int i = 0; i < array_count(plain_options); i++) {
-			if (strcmp(option, plain_options[i].option) == 0) {
+			if (token_equals(token, plain_options[i].option)) {
 				action->type = plain_options[i].type;
 				debug("[%s]\n", plain_options[i].option);
 				return action;
@@ -93,8 +364,8 @@ static struct action *parse_action(struct parser *parser) {
 		}
 
 		// options with arguments.
-		bool activate_oneshot = strcmp(option, "oneshot") == 0;
-		if (activate_oneshot || strcmp(option, "activate") == 0) {
+		bool activate_oneshot = token_equals(token, "oneshot");
+		if (activate_oneshot || token_equals(token, "activate")) {
 			// activate a new layer
 			if (parser_match(parser, Token_Layer)) {
 				struct token layer_token = parser_previous(parser);
@@ -103,28 +374,39 @@ static struct action *parse_action(struct parser *parser) {
 					return action;
 				}
 				action->type = activate_oneshot ? Action_PushLayerOneshot : Action_PushLayer;
-				action->argument.str = copy_string_count_malloc(layer_token.text, layer_token.length);
-				debug("[activate]|%s\n", action->argument.str);
+				// resolved once here instead of looking the layer up by name on every activation.
+				// (activating a layer that has no bindings yet implicitly creates it, like binding to it does)
+				action->argument.layer =
+					find_layer_or_create(parser, intern_string_count(layer_token.text, layer_token.length));
+				if (parser->layer_actions)
+					buf_push(*parser->layer_actions, action);
+				debug("[activate]|%s\n", action->argument.layer->name);
 			} else {
 				parser_report_error(parser, parser_peek(parser), "expected layer\n");
 			}
-		} else if (strcmp(option, "macro") == 0) {
+		} else if (token_equals(token, "macro")) {
 			action->type = Action_Macro;
 			debug("[macro]\n");
 			if (parser_match(parser, Token_BeginList)) {
 				while (parser_match_action(parser)) {
+					struct token item = parser_previous(parser);
 					buf_push(action->argument.actions, parse_action(parser));
+					if (buf_last(action->argument.actions)->retrigger) {
+						// the macro waits for them, they run every time it does.
+						parser_report_error(parser, item, ".retrigger does not apply to commands in a macro\n");
+					}
 				}
 				if (!parser_match(parser, Token_EndList)) {
 					parser_report_error(parser, parser_peek(parser), "']' expected");
 				}
+				merge_macro_commands(action);
 			} else {
 				parser_report_error(parser, parser_peek(parser), "'[' expected");
 			}
-		} else if (strcmp(option, "synthkey") == 0 || strcmp(option, "noresynth") == 0) {
-			bool noresynth = (strcmp(option, "noresynth") == 0);
+		} else if (token_equals(token, "synthkey") || token_equals(token, "noresynth")) {
+			bool noresynth = (token_equals(token, "noresynth"));
 			action->type = noresynth ? Action_SynthKeyNonRecursive : Action_SynthKeyRecursive;
-			debug("[%s]\n", option);
+			debug("[%.*s]\n", token.length, token.text);
 			// .synthkey and .k can have an optional ()
 			bool bracket_found = parser_match(parser, Token_BracketLeft);
 			// comma-separated list of keys.
@@ -134,7 +416,7 @@ static struct action *parse_action(struct parser *parser) {
 				return false;
 			}
 		} else {
-			parser_report_error(parser, token, "invalid option as action: .%s\n", option);
+			parser_report_error(parser, token, "invalid option as action: .%.*s\n", token.length, token.text);
 		}
 	}
 	return action;
@@ -144,11 +426,7 @@ static void parse_process_action_mappings(struct parser *parser, struct hotkey *
 	bool first_iter = true;
 	do {
 		if (parser_match(parser, Token_String)) {
-			struct token name_token = parser_previous(parser);
-			char *name = copy_string_count_malloc(name_token.text, name_token.length);
-			for (char *s = name; *s; ++s)
-				*s = tolower(*s);
-			buf_push(hotkey->process_names, name);
+			buf_push(hotkey->process_names, intern_lowercase(parser_previous(parser)));
 			if (parser_match_action(parser)) {
 				buf_push(hotkey->actions, parse_action(parser));
 			} else {
@@ -175,16 +453,19 @@ static void parse_process_action_mappings(struct parser *parser, struct hotkey *
 	} while (true);
 }
 
-static uint32_t keycode_from_hex(char *hex) {
-	uint32_t result;
-	sscanf(hex, "%x", &result);
+// `0x` followed by hex digits, which the tokenizer only takes in upper case.
+static uint32_t keycode_from_hex(struct token token) {
+	uint32_t result = 0;
+	for (int i = 2; i < token.length; ++i) {
+		char c = token.text[i];
+		result = (result << 4) | (c <= '9' ? c - '0' : c - 'A' + 10);
+	}
 	return result;
 }
 
 static uint32_t parse_key_hex(struct parser *parser) {
 	struct token key = parser_previous(parser);
-	DEFVAR_FROM_TOKEN_TEXT(hex, key);
-	uint32_t keycode = keycode_from_hex(hex);
+	uint32_t keycode = keycode_from_hex(key);
 	debug("\tkey: '%.*s' (0x%02x)\n", key.length, key.text, keycode);
 	return keycode;
 }
@@ -261,14 +542,9 @@ static inline void handle_implicit_literal_flags(struct keyevent *event, int lit
 
 static void parse_key_literal(struct parser *parser, struct keyevent *keyevent) {
 	struct token key = parser_previous(parser);
-	for (int i = 0; i < array_count(literal_keycode_str); ++i) {
-		if (token_equals(key, literal_keycode_str[i])) {
-			handle_implicit_literal_flags(keyevent, i);
-			keyevent->key = literal_keycode_value[i];
-			debug("\tkey: '%.*s' (0x%02x)\n", key.length, key.text, keyevent->key);
-			break;
-		}
-	}
+	handle_implicit_literal_flags(keyevent, key.keyword);
+	keyevent->key = literal_keycode_value[key.keyword];
+	debug("\tkey: '%.*s' (0x%02x)\n", key.length, key.text, keyevent->key);
 }
 
 static enum hotkey_flag modifier_flags_value[] = {
@@ -285,7 +561,7 @@ static void expand_alias(struct parser *parser, struct keyevent *dst, struct tok
 		parser_report_error(parser, alias, "aliases not supported in this layer\n");
 		return;
 	}
-	DEFVAR_FROM_TOKEN_TEXT(alias_name, alias);
+	const char *alias_name = intern_string_count(alias.text, alias.length);
 
 	debug("\tuse_alias: $%s\n", alias_name);
 
@@ -312,14 +588,8 @@ static bool parse_modifier(struct parser *parser, struct keyevent *keyevent) {
 	do {
 		if (parser_match(parser, Token_Modifier)) {
 			struct token modifier = parser_previous(parser);
-
-			for (int i = 0; i < array_count(modifier_flags_str); ++i) {
-				if (token_equals(modifier, modifier_flags_str[i])) {
-					keyevent->flags |= modifier_flags_value[i];
-					debug("\tmod: '%s'\n", modifier_flags_str[i]);
-					break;
-				}
-			}
+			keyevent->flags |= modifier_flags_value[modifier.keyword];
+			debug("\tmod: '%s'\n", modifier_flags_str[modifier.keyword]);
 		} else if (parser_match(parser, Token_Alias)) {
 			// starts with an alias that might contain a modifier
 			struct token alias = parser_previous(parser);
@@ -349,7 +619,7 @@ static int parse_layers(struct parser *parser, struct layer **layer_list, int ma
 	int idx = 0;
 	if (!parser_check(parser, Token_Layer)) {
 		// no layer specified, go with default layer.
-		struct layer *layer = find_layer_or_create(parser, DEFAULT_LAYER);
+		struct layer *layer = find_layer_or_create(parser, intern_string(DEFAULT_LAYER));
 		debug("\tlayer: '%s'\n", layer->name);
 		layer_list[0] = layer;
 		return 1;
@@ -366,8 +636,7 @@ static int parse_layers(struct parser *parser, struct layer **layer_list, int ma
 			return -1;
 		}
 
-		DEFVAR_FROM_TOKEN_TEXT(name, token);
-		struct layer *layer = find_layer_or_create(parser, name);
+		struct layer *layer = find_layer_or_create(parser, intern_string_count(token.text, token.length));
 
 		debug("\tlayer: '%s'\n", layer->name);
 		layer_list[idx++] = layer;
@@ -376,10 +645,10 @@ static int parse_layers(struct parser *parser, struct layer **layer_list, int ma
 }
 
 static void parse_hotkey(struct parser *parser) {
-	struct hotkey *hotkey = tr_malloc(sizeof(struct hotkey));
+	struct hotkey *hotkey = tr_pool_alloc(sizeof(struct hotkey), "hotkeys");
 	memset(hotkey, 0, sizeof(struct hotkey));
 
-	debug("hotkey :: #%d {\n", parser->current_token.line);
+	debug("hotkey :: #%d {\n", token_line(parser, parser->current_token));
 
 	struct layer *layer_list[256];
 	int layer_cnt = parse_layers(parser, layer_list, array_count(layer_list));
@@ -405,6 +674,8 @@ static void parse_hotkey(struct parser *parser) {
 	for (int i = 0; i < layer_cnt; i++) {
 		struct layer *layer = layer_list[i];
 		add_hotkey_to_layer(layer, hotkey);
+		if (parser->bindings)
+			buf_push(*parser->bindings, ((struct layer_binding){.layer = layer->name, .hotkey = hotkey}));
 	}
 
 	debug("}\n");
@@ -412,12 +683,9 @@ static void parse_hotkey(struct parser *parser) {
 
 void parse_option_blocklist(struct parser *parser) {
 	if (parser_match(parser, Token_String)) {
-		struct token name_token = parser_previous(parser);
-		char *name = copy_string_count_malloc(name_token.text, name_token.length);
-		for (char *s = name; *s; ++s)
-			*s = tolower(*s);
+		const char *name = intern_lowercase(parser_previous(parser));
 		debug("\t%s\n", name);
-		table_add(parser->blocklst, name, name);
+		table_add(parser->blocklst, name, (void *)name);
 		parse_option_blocklist(parser);
 	} else if (parser_match(parser, Token_EndList)) {
 		if (parser->blocklst->count == 0) {
@@ -428,35 +696,34 @@ void parse_option_blocklist(struct parser *parser) {
 	}
 }
 
+char *parser_load_path(const char *file, const char *name, unsigned length) {
+	const char *last_slash = strrchr(file, '/');
+	if (*name == '/' || last_slash == NULL)
+		return copy_string_count_malloc(name, length);
+
+	int directory_length = last_slash - file;
+	size_t total_length = directory_length + length + 2;
+	char *absolutepath = tr_malloc(total_length * sizeof(char));
+	snprintf(absolutepath, total_length, "%.*s/%.*s", directory_length, file, length, name);
+	return absolutepath;
+}
+
 void parse_option_load(struct parser *parser, struct token option) {
 	struct token filename_token = parser_previous(parser);
-	char *filename = copy_string_count_malloc(filename_token.text, filename_token.length);
+	char *filename = parser_load_path(parser->file, filename_token.text, filename_token.length);
 	debug("\t%s\n", filename);
 
-	if (*filename != '/') {
-		char *directory = file_directory(parser->file);
-
-		size_t directory_length = strlen(directory);
-		size_t filename_length = strlen(filename);
-		size_t total_length = directory_length + filename_length + 2;
-
-		char *absolutepath = tr_malloc(total_length * sizeof(char));
-		snprintf(absolutepath, total_length, "%s/%s", directory, filename);
-		tr_free(filename);
-
-		filename = absolutepath;
-	}
-
-	buf_push(parser->load_directives, ((struct load_directive){.file = filename, .option = option}));
+	struct token_position position = tokenizer_position(&parser->tokenizer, option);
+	buf_push(parser->load_directives, ((struct load_directive){.file = filename, .position = position}));
 }
 
 void parse_option_alias(struct parser *parser) {
 	struct token alias_token = parser_previous(parser);
-	char *alias_name = copy_string_count_malloc(alias_token.text, alias_token.length);
+	const char *alias_name = intern_string_count(alias_token.text, alias_token.length);
 	debug("\talias_name: $%s\n", alias_name);
 
-	struct keyevent *keyevent = tr_malloc(sizeof(struct hotkey));
-	memset(keyevent, 0, sizeof(struct hotkey));
+	struct keyevent *keyevent = tr_pool_alloc(sizeof(struct keyevent), "keyevents");
+	memset(keyevent, 0, sizeof(struct keyevent));
 	parse_keyevent(parser, keyevent, true);
 
 	// later definition of the same alias takes predecence over previous ones.
@@ -468,7 +735,7 @@ void parse_option(struct parser *parser) {
 	struct token option = parser_previous(parser);
 	if (token_equals(option, "blocklist")) {
 		if (parser_match(parser, Token_BeginList)) {
-			debug("blocklist :: #%d {\n", option.line);
+			debug("blocklist :: #%d {\n", token_line(parser, option));
 			parse_option_blocklist(parser);
 			debug("}\n");
 		} else {
@@ -476,7 +743,7 @@ void parse_option(struct parser *parser) {
 		}
 	} else if (token_equals(option, "load")) {
 		if (parser_match(parser, Token_String)) {
-			debug("load :: #%d {\n", option.line);
+			debug("load :: #%d {\n", token_line(parser, option));
 			parse_option_load(parser, option);
 			debug("}\n");
 		} else {
@@ -484,12 +751,29 @@ void parse_option(struct parser *parser) {
 		}
 	} else if (token_equals(option, "alias")) {
 		if (parser_match(parser, Token_Alias)) {
-			debug("alias :: #%d {\n", option.line);
+			debug("alias :: #%d {\n", token_line(parser, option));
 			parse_option_alias(parser);
 			debug("}\n");
 		} else {
 			parser_report_error(parser, option, "expected $alias_name\n");
 		}
+	} else if (token_equals(option, "max_jobs")) {
+		int max_jobs;
+		if (parse_number(parser, &max_jobs) && max_jobs <= SPAWN_MAX_JOBS) {
+			debug("max_jobs :: #%d { %d }\n", token_line(parser, option), max_jobs);
+			if (parser->options)
+				parser->options->max_jobs = max_jobs;
+		} else {
+			parser_report_error(parser, option, "expected the number of commands to run at the same time (0 to %d)\n",
+								SPAWN_MAX_JOBS);
+		}
+	} else if (token_equals(option, "retrigger")) {
+		enum retrigger retrigger = parse_retrigger(parser);
+		if (!parser->error) {
+			debug("retrigger :: #%d { %s }\n", token_line(parser, option), retrigger_names[retrigger]);
+			if (parser->options)
+				parser->options->retrigger = retrigger;
+		}
 	} else {
 		parser_report_error(parser, option, "invalid option specified\n");
 	}
@@ -568,22 +852,22 @@ bool parse_keyevent(struct parser *parser, struct keyevent *keyevent, bool allow
 	keyevent->key = INVALID_KEY; // keycode 0 is actually a valid keycode (kVK_ANSI_A)
 
 	if (parser_match(parser, Token_Event)) { // @pseudo_keys
-		DEFVAR_FROM_TOKEN_TEXT(pktype, parser_previous(parser));
-		if (strcmp(pktype, "unmatched") == 0) {
+		struct token pktype = parser_previous(parser);
+		if (token_equals(pktype, "unmatched")) {
 			keyevent->type = Event_Unmatched;
-		} else if (strcmp(pktype, "enter_layer") == 0) {
+		} else if (token_equals(pktype, "enter_layer")) {
 			keyevent->type = Event_EnterLayer;
-		} else if (strcmp(pktype, "exit_layer") == 0) {
+		} else if (token_equals(pktype, "exit_layer")) {
 			keyevent->type = Event_ExitLayer;
-		} else if (strcmp(pktype, "keydown") == 0) {
+		} else if (token_equals(pktype, "keydown")) {
 			keyevent->type = Event_KeyDown;
-		} else if (strcmp(pktype, "keyup") == 0) {
+		} else if (token_equals(pktype, "keyup")) {
 			keyevent->type = Event_KeyUp;
 		} else {
-			parser_report_error(parser, parser_previous(parser), "invalid pseudo key: @%s\n", pktype);
+			parser_report_error(parser, pktype, "invalid pseudo key: @%.*s\n", pktype.length, pktype.text);
 			return false;
 		}
-		debug("\tpseudo_key: @%s\n", pktype);
+		debug("\tpseudo_key: @%.*s\n", pktype.length, pktype.text);
 
 		if (keyevent->type == Event_Key || keyevent->type == Event_KeyDown || keyevent->type == Event_KeyUp) {
 			if (!parser_match(parser, Token_BracketLeft)) {
@@ -612,8 +896,8 @@ struct keyevent *parse_keyevent_list(struct parser *parser) {
 		len++;
 		if (len > maxlen) {
 			maxlen = 2 * len;
-			keyevents = tr_realloc(
-				keyevents, (maxlen + 1) * sizeof(struct keyevent)); // + 1 for the Event_Null at the end of the list
+			keyevents = tr_realloc_tag(keyevents, (maxlen + 1) * sizeof(struct keyevent),
+									   "keyevents"); // + 1 for the Event_Null at the end of the list
 		}
 		if (!parse_keyevent(parser, &keyevents[len - 1], true)) {
 			return NULL;
@@ -659,58 +943,44 @@ bool parser_match(struct parser *parser, enum token_type type) {
 void parser_report_error(struct parser *parser, struct token token, const char *format, ...) {
 	va_list args;
 	va_start(args, format);
-	fprintf(stderr, "#%d:%d ", token.line, token.cursor);
-	vfprintf(stderr, format, args);
-	va_end(args);
-	parser->error = true;
-}
-
-void parser_do_directives(struct parser *parser, struct hotloader *hotloader, bool thwart_hotloader) {
-	for (int i = 0; i < buf_len(parser->load_directives); ++i) {
-		struct load_directive load = parser->load_directives[i];
-
-		struct parser directive_parser;
-		if (parser_init(&directive_parser, parser->layer_map, parser->blocklst, parser->alias_map, load.file)) {
-			if (!thwart_hotloader) {
-				hotloader_add_file(hotloader, load.file);
-			}
-
-			if (parse_config(&directive_parser)) {
-				parser_do_directives(&directive_parser, hotloader, thwart_hotloader);
-			}
-
-			parser_destroy(&directive_parser);
-		} else {
-			warn("mkhd: could not open file '%s' from load directive #%d:%d\n", load.file, load.option.line,
-				 load.option.cursor);
+	struct token_position position = tokenizer_position(&parser->tokenizer, token);
+	if (parser->messages) {
+		char message[512];
+		int length = snprintf(message, sizeof(message), "#%d:%d ", position.line, position.cursor);
+		vsnprintf(message + length, sizeof(message) - length, format, args);
+		for (char *c = message; *c; ++c) {
+			buf_push(*parser->messages, *c);
 		}
-
-		tr_free(load.file);
+	} else {
+		fprintf(stderr, "#%d:%d ", position.line, position.cursor);
+		vfprintf(stderr, format, args);
 	}
-	buf_free(parser->load_directives);
+	va_end(args);
+	parser->error = true;
 }
 
 bool parser_init(struct parser *parser, struct table *layer_map, struct table *blocklst, struct table *alias_map,
 				 char *file) {
 	memset(parser, 0, sizeof(struct parser));
-	char *buffer = read_file(file);
-	if (buffer) {
+	struct source_file source;
+	if (parser_read_file(file, &source)) {
 		parser->file = file;
 		parser->layer_map = layer_map;
 		parser->blocklst = blocklst;
 		parser->alias_map = alias_map;
-		tokenizer_init(&parser->tokenizer, buffer);
+		tokenizer_init(&parser->tokenizer, source.text, source.length);
 		parser_advance(parser);
 		return true;
 	}
 	return false;
 }
 
-bool parser_init_text(struct parser *parser, char *text) {
+bool parser_init_text(struct parser *parser, char *text, size_t length) {
 	memset(parser, 0, sizeof(struct parser));
-	tokenizer_init(&parser->tokenizer, text);
+	tokenizer_init(&parser->tokenizer, text, length);
 	parser_advance(parser);
 	return true;
 }
 
+// only for a parser set up by `parser_init()`, which read the file.
 void parser_destroy(struct parser *parser) { tr_free(parser->tokenizer.buffer); }
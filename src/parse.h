@@ -1,26 +1,45 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "hotkey.h"
-#include "hotload.h"
 #include "tokenize.h"
 
 struct load_directive {
 	char *file;
-	struct token option;
+	struct token_position position; // of the `.load`, for warnings about it
 };
 
+struct layer_binding {
+	const char *layer; // interned
+	struct hotkey *hotkey;
+};
+
+// the text of a config file. it is not NUL terminated.
+struct source_file {
+	char *text;
+	size_t length;
+};
+
+struct config_options;
 struct table;
 struct parser {
-	char *file;
+	const char *file;
 	struct token previous_token;
 	struct token current_token;
 	struct tokenizer tokenizer;
 	struct table *layer_map;
 	struct table *blocklst;
 	struct table *alias_map;
+	struct config_options *options;
 	struct load_directive *load_directives;
+	// if set, every binding is appended in the order it was made, and every action that activates a layer. so the file
+	// can later be replayed into another config's layers, see config_cache.c.
+	struct layer_binding **bindings;
+	struct action ***layer_actions;
+	// if set, errors are appended here instead of being printed.
+	char **messages;
 	bool error;
 };
 
@@ -36,7 +55,12 @@ bool parser_check(struct parser *parser, enum token_type type);
 bool parser_match(struct parser *parser, enum token_type type);
 bool parser_init(struct parser *parser, struct table *layer_map, struct table *blocklst, struct table *alias_map,
 				 char *file);
-bool parser_init_text(struct parser *parser, char *text);
+bool parser_init_text(struct parser *parser, char *text, size_t length);
 void parser_destroy(struct parser *parser);
 void parser_report_error(struct parser *parser, struct token token, const char *format, ...);
-void parser_do_directives(struct parser *parser, struct hotloader *hotloader, bool thwart_hotloader);
+// reads `file` into `source`. false, leaving `source` as it is, if the file can not be opened, is not a regular file or
+// can not be read.
+bool parser_read_file(const char *file, struct source_file *source);
+void parser_free_file(struct source_file *source);
+// the path of the file `.load "name"` in `file` refers to. relative names are relative to the directory of `file`.
+char *parser_load_path(const char *file, const char *name, unsigned length);
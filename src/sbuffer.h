@@ -27,7 +27,7 @@ struct buf_hdr {
 inline static void *buf__grow_f(const void *buf, size_t new_len, size_t elem_size) {
 	size_t new_cap = buf_MAX(1 + 2 * buf_cap(buf), new_len);
 	size_t new_size = buf_OFFSETOF(struct buf_hdr, buf) + new_cap * elem_size;
-	struct buf_hdr *new_hdr = (struct buf_hdr *)tr_realloc(buf ? buf__hdr(buf) : 0, new_size);
+	struct buf_hdr *new_hdr = (struct buf_hdr *)tr_realloc_tag(buf ? buf__hdr(buf) : 0, new_size, "buffers");
 	new_hdr->cap = new_cap;
 	if (!buf) {
 		new_hdr->len = 0;
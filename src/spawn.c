@@ -0,0 +1,563 @@
+#include "spawn.h"
+
+#include <dispatch/dispatch.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+static char arg[] = "-c";
+static char *shell = NULL;
+
+extern char **environ;
+
+static struct spawn_job *running_jobs; // the jobs of forked commands and spawned programs
+
+// every command, program and worker runs in a session of its own, with every signal at its default and none blocked.
+// ignored signals stay ignored across exec, and the daemon ignores SIGUSR1 and SIGUSR2. see `handle_signal()`.
+// programs get this from `program_attributes`, forked children from `reset_child()`.
+static posix_spawnattr_t program_attributes;
+
+// called in a forked child before exec.
+static void reset_child(void) {
+	setsid();
+	for (int signal_number = 1; signal_number < NSIG; ++signal_number) {
+		if (signal_number != SIGKILL && signal_number != SIGSTOP)
+			signal(signal_number, SIG_DFL);
+	}
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigprocmask(SIG_SETMASK, &signals, NULL);
+}
+
+// shells started once and kept running. a command is written to an idle one, instead of forking the daemon and starting
+// a shell (rc files and all) for every command. the worker runs it in a subshell, `(eval '...')`, so it can not change
+// the worker's state, and writes a byte to WORKER_REPLY_FD once the command exited.
+#define SHELL_WORKERS 4
+#define WORKER_REPLY_FD 9
+#define WORKER_SCRIPT_MAX 4096 // longer commands are forked
+
+struct shell_worker {
+	pid_t pid;	  // 0 if it is not running
+	int commands; // the worker's stdin
+	int replies;  // what it writes to WORKER_REPLY_FD, also the context of `reply_source`
+	dispatch_source_t reply_source;
+	bool busy;
+	struct spawn_job *job; // of the command it is running, if it was given one
+	time_t started;
+};
+
+static struct shell_worker workers[SHELL_WORKERS];
+
+void init_shell(void) {
+	if (!shell) {
+		char *env_shell = getenv("SHELL");
+		shell = env_shell ? env_shell : "/bin/bash";
+	}
+}
+
+bool spawn_shell_is_posix(void) {
+	static const char *posix_shells[] = {"sh", "bash", "zsh", "dash", "ksh", "mksh"};
+	const char *name = strrchr(shell, '/');
+	name = name ? name + 1 : shell;
+	for (int i = 0; i < sizeof(posix_shells) / sizeof(*posix_shells); ++i) {
+		if (strcmp(name, posix_shells[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void finish_job(struct spawn_job *job) {
+	if (job) {
+		job->pid = 0;
+		job->exited(job);
+	}
+}
+
+static struct shell_worker *worker_with_replies(int replies) {
+	for (int i = 0; i < SHELL_WORKERS; ++i) {
+		if (workers[i].pid && workers[i].replies == replies)
+			return &workers[i];
+	}
+	return NULL;
+}
+
+static void worker_replied(void *context) {
+	int replies = (int)(intptr_t)context;
+	struct shell_worker *worker = worker_with_replies(replies);
+	if (worker == NULL)
+		return; // already reaped, its source is being cancelled
+
+	char buffer[16];
+	ssize_t count = read(replies, buffer, sizeof(buffer));
+	if (count > 0) {
+		// one command at a time, there is never more than one byte.
+		struct spawn_job *job = worker->job;
+		worker->job = NULL;
+		worker->busy = false;
+		finish_job(job);
+	} else if (count == 0) {
+		// the shell closed its end without exiting. it is of no use anymore, it is replaced once it is reaped.
+		dispatch_source_cancel(worker->reply_source);
+		worker->busy = true;
+		kill(worker->pid, SIGTERM);
+	}
+}
+
+// the source is gone, the descriptor can be closed.
+static void worker_replies_closed(void *context) { close((int)(intptr_t)context); }
+
+static bool start_worker(struct shell_worker *worker) {
+	int commands[2];
+	int replies[2];
+	if (pipe(commands) == -1)
+		return false;
+	if (pipe(replies) == -1) {
+		close(commands[0]);
+		close(commands[1]);
+		return false;
+	}
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		reset_child();
+		dup2(commands[0], STDIN_FILENO);
+		dup2(replies[1], WORKER_REPLY_FD);
+		// any of them may have been WORKER_REPLY_FD, which is taken now.
+		int pipes[] = {commands[0], commands[1], replies[0], replies[1]};
+		for (int i = 0; i < 4; ++i) {
+			if (pipes[i] != STDIN_FILENO && pipes[i] != WORKER_REPLY_FD)
+				close(pipes[i]);
+		}
+		char *exec[] = {shell, "-s", NULL};
+		execvp(exec[0], exec);
+		_exit(127);
+	}
+	close(commands[0]);
+	close(replies[1]);
+	if (pid == -1) {
+		close(commands[1]);
+		close(replies[0]);
+		return false;
+	}
+
+	// the commands that are forked must not hold on to the worker's pipes.
+	fcntl(commands[1], F_SETFD, FD_CLOEXEC);
+	fcntl(replies[0], F_SETFD, FD_CLOEXEC);
+	// a write to a worker that just exited fails instead of raising SIGPIPE.
+	fcntl(commands[1], F_SETNOSIGPIPE, 1);
+
+	*worker = (struct shell_worker){
+		.pid = pid,
+		.commands = commands[1],
+		.replies = replies[0],
+		.started = time(NULL),
+	};
+	worker->reply_source = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, replies[0], 0, dispatch_get_main_queue());
+	dispatch_set_context(worker->reply_source, (void *)(intptr_t)replies[0]);
+	dispatch_source_set_event_handler_f(worker->reply_source, worker_replied);
+	dispatch_source_set_cancel_handler_f(worker->reply_source, worker_replies_closed);
+	dispatch_resume(worker->reply_source);
+	return true;
+}
+
+// a worker exited, its command (if it was running one) is done. it is replaced right away, unless it did not even
+// survive its first second.
+static void worker_exited(struct shell_worker *worker) {
+	dispatch_source_cancel(worker->reply_source);
+	dispatch_release(worker->reply_source);
+	close(worker->commands);
+	struct spawn_job *job = worker->job;
+	bool short_lived = time(NULL) - worker->started < 2;
+	*worker = (struct shell_worker){0};
+
+	if (short_lived) {
+		// the shell is probably unusable, the slot stays empty.
+		warn("mkhd: shell worker '%s -s' exited right after it was started, not using it anymore.\n", shell);
+	} else if (!start_worker(worker)) {
+		warn("mkhd: could not restart a shell worker.\n");
+	}
+	finish_job(job);
+}
+
+static void job_exited(pid_t pid) {
+	for (struct spawn_job **link = &running_jobs; *link; link = &(*link)->next) {
+		struct spawn_job *job = *link;
+		if (job->pid == pid) {
+			*link = job->next;
+			finish_job(job);
+			return;
+		}
+	}
+}
+
+// SIGCHLD is coalesced, one signal may stand for any number of exited commands and workers.
+static void sigchld_handler(void *context) {
+	pid_t pid;
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+		bool worker = false;
+		for (int i = 0; i < SHELL_WORKERS && !worker; ++i) {
+			if (workers[i].pid == pid) {
+				worker_exited(&workers[i]);
+				worker = true;
+			}
+		}
+		if (!worker)
+			job_exited(pid);
+	}
+}
+
+void spawn_init(void) {
+	// the default action for SIGCHLD is to do nothing, but unlike ignoring it, it leaves exited children for us to
+	// reap. the source sees the signal either way.
+	signal(SIGCHLD, SIG_DFL);
+	dispatch_source_t source =
+		dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGCHLD, 0, dispatch_get_main_queue());
+	dispatch_source_set_event_handler_f(source, sigchld_handler);
+	dispatch_resume(source); // lives as long as the process
+
+	sigset_t signals;
+	posix_spawnattr_init(&program_attributes);
+	posix_spawnattr_setflags(&program_attributes, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+	sigfillset(&signals);
+	posix_spawnattr_setsigdefault(&program_attributes, &signals);
+	sigemptyset(&signals);
+	posix_spawnattr_setsigmask(&program_attributes, &signals);
+
+	if (!spawn_shell_is_posix()) {
+		debug("mkhd: '%s' is not a POSIX shell, commands are not run by shell workers.\n", shell);
+		return;
+	}
+	int started = 0;
+	for (int i = 0; i < SHELL_WORKERS; ++i) {
+		if (start_worker(&workers[i]))
+			started++;
+	}
+	debug("mkhd: started %d shell workers.\n", started);
+}
+
+// `(eval 'command') </dev/null 9>&-; echo >&9`, with the command's single quotes escaped. (9 is WORKER_REPLY_FD)
+// false if it does not fit.
+static bool worker_script(const char *command, char *script, int *length) {
+	static const char prefix[] = "(eval '";
+	static const char suffix[] = "') </dev/null 9>&-; echo >&9\n";
+	int at = sizeof(prefix) - 1;
+	memcpy(script, prefix, at);
+	for (const char *c = command; *c; ++c) {
+		if (at + 4 + sizeof(suffix) > WORKER_SCRIPT_MAX)
+			return false;
+		if (*c == '\'') {
+			memcpy(script + at, "'\\''", 4);
+			at += 4;
+		} else {
+			script[at++] = *c;
+		}
+	}
+	memcpy(script + at, suffix, sizeof(suffix) - 1);
+	*length = at + sizeof(suffix) - 1;
+	return true;
+}
+
+static bool run_on_worker(const char *command, struct spawn_job *job) {
+	struct shell_worker *worker = NULL;
+	for (int i = 0; i < SHELL_WORKERS && worker == NULL; ++i) {
+		if (workers[i].pid && !workers[i].busy)
+			worker = &workers[i];
+	}
+	if (worker == NULL)
+		return false;
+
+	static char script[WORKER_SCRIPT_MAX];
+	int length;
+	if (!worker_script(command, script, &length))
+		return false;
+	// the worker is idle, its pipe is empty and takes the whole script without blocking.
+	if (write(worker->commands, script, length) != length) {
+		// it exited and is about to be reaped.
+		worker->busy = true;
+		return false;
+	}
+
+	worker->busy = true;
+	worker->job = job;
+	if (job)
+		job->pid = worker->pid;
+	return true;
+}
+
+static void add_running_job(struct spawn_job *job, pid_t pid) {
+	if (job) {
+		// the process can not have been reaped yet, that only happens once we are back on the main queue.
+		job->pid = pid;
+		job->next = running_jobs;
+		running_jobs = job;
+	}
+}
+
+static bool fork_command(const char *command, struct spawn_job *job) {
+	int cpid = fork();
+	if (cpid == 0) {
+		reset_child();
+		char *exec[] = {shell, arg, (char *)command, NULL};
+		int status_code = execvp(exec[0], exec);
+		_exit(status_code);
+	} else if (cpid == -1) {
+		warn("mkhd: could not run '%s'\n", command);
+		return false;
+	}
+
+	add_running_job(job, cpid);
+	return true;
+}
+
+bool spawn_command(const char *command, struct spawn_job *job) {
+	return run_on_worker(command, job) || fork_command(command, job);
+}
+
+bool spawn_program(const struct exec_command *exec, struct spawn_job *job) {
+	pid_t pid;
+	int result = posix_spawn(&pid, exec->path, NULL, &program_attributes, exec->argv, environ);
+	if (result != 0) {
+		debug("mkhd: could not start '%s' (%s), running it with the shell.\n", exec->path, strerror(result));
+		return spawn_command(exec->command, job);
+	}
+	add_running_job(job, pid);
+	return true;
+}
+
+static bool is_program(const char *path) {
+	struct stat info;
+	return stat(path, &info) == 0 && S_ISREG(info.st_mode) && access(path, X_OK) == 0;
+}
+
+bool spawn_find_program(const char *name, char *path, size_t size) {
+	if (strchr(name, '/')) {
+		// used as it is, relative ones would depend on the daemon's working directory.
+		if (name[0] != '/' || strlen(name) >= size || !is_program(name))
+			return false;
+		strcpy(path, name);
+		return true;
+	}
+
+	const char *search = getenv("PATH");
+	if (search == NULL)
+		search = "/usr/bin:/bin:/usr/sbin:/sbin";
+	while (*search) {
+		const char *end = strchr(search, ':');
+		int length = end ? end - search : strlen(search);
+		// an empty entry is the working directory, which is not where the daemon's commands are run from.
+		if (length > 0 && search[0] == '/' && snprintf(path, size, "%.*s/%s", length, search, name) < size &&
+			is_program(path))
+			return true;
+		search += end ? length + 1 : length;
+	}
+	return false;
+}
+
+// the scheduler. a run is tracked in a slot of `scheduled_runs` while its command runs, and waits in `waiting_runs`
+// until there is room for it.
+#define SCHEDULED_RUNS_MAX SPAWN_MAX_JOBS
+#define WAITING_RUNS_MAX 64
+
+struct scheduled_run {
+	struct spawn_job job;	   // first, see `scheduled_run_exited()`. the slot is taken while it is running
+	struct mkhd_state *mstate; // NULL once the config was released
+	struct action *action;
+	struct spawn_job *caller;
+};
+
+struct waiting_run {
+	struct mkhd_state *mstate;
+	struct action *action;
+	enum retrigger retrigger;
+	struct spawn_job *caller;
+};
+
+static struct scheduled_run scheduled_runs[SCHEDULED_RUNS_MAX];
+static struct waiting_run waiting_runs[WAITING_RUNS_MAX]; // oldest first
+static int waiting_count;
+static int running_count;
+static int max_jobs;
+
+static struct {
+	unsigned long started;
+	unsigned long waited;	  // had to wait for their turn
+	unsigned long coalesced;  // merged into a run of the same action that was already waiting
+	unsigned long dropped;	  // by `.retrigger drop`
+	unsigned long overflowed; // dropped because the queue was full
+	unsigned long forgotten;  // dropped while waiting, their config was released
+	int peak_running;
+	int peak_waiting;
+} scheduler_stats;
+
+static bool start_command(struct action *action, struct spawn_job *job) {
+	if (action->type == Action_Exec)
+		return spawn_program(action->argument.exec, job);
+	return spawn_command(action->argument.str, job);
+}
+
+static bool has_room(void) { return max_jobs == 0 || running_count < max_jobs; }
+
+static bool is_running(struct action *action) {
+	for (int i = 0; i < SCHEDULED_RUNS_MAX; ++i) {
+		if (scheduled_runs[i].job.pid && scheduled_runs[i].action == action)
+			return true;
+	}
+	return false;
+}
+
+static bool is_waiting(struct action *action) {
+	for (int i = 0; i < waiting_count; ++i) {
+		if (waiting_runs[i].action == action)
+			return true;
+	}
+	return false;
+}
+
+static void scheduled_run_exited(struct spawn_job *job);
+
+// false if the command could not be started, the caller's job is not called then.
+static bool start_run(struct mkhd_state *mstate, struct action *action, struct spawn_job *caller) {
+	struct scheduled_run *run = NULL;
+	for (int i = 0; i < SCHEDULED_RUNS_MAX && run == NULL; ++i) {
+		if (scheduled_runs[i].job.pid == 0)
+			run = &scheduled_runs[i];
+	}
+	if (run == NULL) {
+		// every slot is taken, which only happens without a limit. the command runs without being kept track of.
+		return start_command(action, caller);
+	}
+
+	*run = (struct scheduled_run){.mstate = mstate, .action = action, .caller = caller};
+	run->job.exited = scheduled_run_exited;
+	if (!start_command(action, &run->job))
+		return false;
+	if (caller)
+		caller->pid = run->job.pid;
+	scheduler_stats.started++;
+	if (++running_count > scheduler_stats.peak_running)
+		scheduler_stats.peak_running = running_count;
+	return true;
+}
+
+// starts as many of the waiting runs as there is room for, oldest first. a coalescing run waits until the last run of
+// its action exited.
+static void start_waiting_runs(void) {
+	for (int i = 0; i < waiting_count && has_room();) {
+		struct waiting_run waiting = waiting_runs[i];
+		if (waiting.retrigger == Retrigger_Coalesce && is_running(waiting.action)) {
+			++i;
+			continue;
+		}
+		memmove(&waiting_runs[i], &waiting_runs[i + 1], sizeof(struct waiting_run) * (waiting_count - i - 1));
+		--waiting_count;
+		if (waiting.caller)
+			waiting.caller->waiting = false;
+		// the caller may run another action right away, which only ever appends to `waiting_runs`.
+		if (!start_run(waiting.mstate, waiting.action, waiting.caller))
+			finish_job(waiting.caller);
+	}
+}
+
+static void scheduled_run_exited(struct spawn_job *job) {
+	struct scheduled_run *run = (struct scheduled_run *)job;
+	struct spawn_job *caller = run->caller;
+	run->mstate = NULL;
+	run->action = NULL;
+	--running_count;
+	start_waiting_runs();
+	finish_job(caller);
+}
+
+bool spawn_action(struct mkhd_state *mstate, struct action *action, enum retrigger retrigger, struct spawn_job *job) {
+	if (job || retrigger == Retrigger_Default)
+		retrigger = Retrigger_Queue;
+	if (retrigger == Retrigger_Drop && (is_running(action) || is_waiting(action))) {
+		scheduler_stats.dropped++;
+		return false;
+	}
+	if (retrigger == Retrigger_Coalesce && is_waiting(action)) {
+		scheduler_stats.coalesced++;
+		return true;
+	}
+
+	// with room to spare, the runs that still wait are waiting for the last run of their own action. starting this one
+	// right away does not overtake any of them.
+	bool blocked = retrigger == Retrigger_Coalesce && is_running(action);
+	if (!blocked && has_room())
+		return start_run(mstate, action, job);
+
+	if (waiting_count == WAITING_RUNS_MAX) {
+		scheduler_stats.overflowed++;
+		debug("mkhd: too many commands waiting, dropping '%s'\n",
+			  action->type == Action_Exec ? action->argument.exec->command : action->argument.str);
+		return false;
+	}
+	waiting_runs[waiting_count++] = (struct waiting_run){
+		.mstate = mstate,
+		.action = action,
+		.retrigger = retrigger,
+		.caller = job,
+	};
+	if (job)
+		job->waiting = true;
+	scheduler_stats.waited++;
+	if (waiting_count > scheduler_stats.peak_waiting)
+		scheduler_stats.peak_waiting = waiting_count;
+	return true;
+}
+
+void spawn_set_max_jobs(int jobs) {
+	max_jobs = jobs < SCHEDULED_RUNS_MAX ? jobs : SCHEDULED_RUNS_MAX;
+	start_waiting_runs();
+}
+
+void spawn_forget_config(struct mkhd_state *mstate) {
+	for (int i = 0; i < SCHEDULED_RUNS_MAX; ++i) {
+		if (scheduled_runs[i].mstate == mstate) {
+			// still running, but its action is about to be gone.
+			scheduled_runs[i].mstate = NULL;
+			scheduled_runs[i].action = NULL;
+		}
+	}
+
+	struct spawn_job *callers[WAITING_RUNS_MAX];
+	int caller_count = 0;
+	int kept = 0;
+	for (int i = 0; i < waiting_count; ++i) {
+		struct waiting_run waiting = waiting_runs[i];
+		if (waiting.mstate != mstate) {
+			waiting_runs[kept++] = waiting;
+			continue;
+		}
+		scheduler_stats.forgotten++;
+		if (waiting.caller)
+			callers[caller_count++] = waiting.caller;
+	}
+	waiting_count = kept;
+	for (int i = 0; i < caller_count; ++i) {
+		callers[i]->waiting = false;
+		finish_job(callers[i]);
+	}
+}
+
+void spawn_print_stats(FILE *out) {
+	if (max_jobs)
+		fprintf(out, "mkhd: commands (at most %d at a time):\n", max_jobs);
+	else
+		fprintf(out, "mkhd: commands (no limit):\n");
+	fprintf(out, "  running %d (peak %d)  waiting %d (peak %d)\n", running_count, scheduler_stats.peak_running,
+			waiting_count, scheduler_stats.peak_waiting);
+	fprintf(out, "  started %lu  waited %lu  coalesced %lu  dropped %lu  queue full %lu  forgotten on reload %lu\n",
+			scheduler_stats.started, scheduler_stats.waited, scheduler_stats.coalesced, scheduler_stats.dropped,
+			scheduler_stats.overflowed, scheduler_stats.forgotten);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "hotkey.h"
+
+// shell commands run in the background, key events never wait for them. whoever needs to know when a command exited
+// passes a job, which is kept track of until then. nothing here allocates, commands are started while dispatching key
+// events. main thread only.
+
+struct mkhd_state;
+struct spawn_job;
+typedef void spawn_callback(struct spawn_job *job);
+
+struct spawn_job {
+	pid_t pid;				// the command's process, or the shell worker running it. 0 unless it is running
+	bool waiting;			// for its turn, see `spawn_action()`
+	spawn_callback *exited; // called on the main queue once the command exited
+	struct spawn_job *next; // the running jobs
+};
+
+static inline bool spawn_job_active(struct spawn_job *job) { return job->pid != 0 || job->waiting; }
+
+void init_shell(void);
+// whether the user's shell takes POSIX shell syntax. the script written to the shell workers is POSIX shell, with any
+// other shell (eg. fish) every command is forked. (after `init_shell()`, can be called from any thread)
+bool spawn_shell_is_posix(void);
+// reaps commands as they exit, and starts the shell workers. (after `init_shell()`)
+// takes over SIGCHLD, which must not be ignored. (that reaps them before we can)
+void spawn_init(void);
+// runs `command` with the user's shell. if `job` is given, its `exited` callback is called once the command exited.
+// false if the command could not be started, the job is not called then.
+bool spawn_command(const char *command, struct spawn_job *job);
+// runs the program of `exec` directly, with the daemon's environment. falls back to the shell if the program can not
+// be started anymore (eg. it was removed since the config was parsed). the job is handled like `spawn_command()`'s.
+bool spawn_program(const struct exec_command *exec, struct spawn_job *job);
+// looks `name` up like execvp() would, writing the program's path to `path`. false if there is no such program.
+// can be called from any thread.
+bool spawn_find_program(const char *name, char *path, size_t size);
+
+// the commands of actions go through a scheduler: at most `max_jobs` of them run at the same time (0 for no limit),
+// the others wait for their turn in the order they were triggered, and are dropped if too many wait already.
+// `retrigger` decides what happens when the action is triggered again while its last run is still running or waiting.
+// it only applies to runs without a job, those with one are always queued. `mstate` is the config the action is from.
+// the job is handled like `spawn_command()`'s. while it waits, it is `waiting`, and called as if its command exited if
+// the command is dropped or can not be started after all.
+// false if the command was dropped or could not be started.
+#define SPAWN_MAX_JOBS 64 // the highest limit
+bool spawn_action(struct mkhd_state *mstate, struct action *action, enum retrigger retrigger, struct spawn_job *job);
+void spawn_set_max_jobs(int max_jobs);
+// drops the runs of `mstate`'s actions that are still waiting, before the config is released. their jobs are called.
+void spawn_forget_config(struct mkhd_state *mstate);
+void spawn_print_stats(FILE *out);
@@ -1,6 +1,7 @@
 #include "synthesize.h"
 
 #include <Carbon/Carbon.h>
+#include <string.h>
 
 #include "hotkey.h"
 #include "locale.h"
@@ -70,7 +71,7 @@ bool parse_and_synthesize_key(char *key_string, bool nore) {
 		return false;
 
 	struct parser parser;
-	parser_init_text(&parser, key_string);
+	parser_init_text(&parser, key_string, strlen(key_string));
 
 	if (!verbose) {
 		close(1);
@@ -1,7 +1,16 @@
 #include "tokenize.h"
 
-#include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "keywords.h"
 
 #define array_count(a) (sizeof((a)) / sizeof(*(a)))
 
@@ -15,43 +24,133 @@ int token_equals(struct token token, const char *match) {
 	return (*at == 0);
 }
 
-static void advance(struct tokenizer *tokenizer) {
-	if (*tokenizer->at == '\n') {
-		tokenizer->cursor = 0;
-		++tokenizer->line;
+// character classes of the C locale, so the tokenizer does not depend on the current one.
+enum char_class {
+	Char_Space = 1 << 0,
+	Char_Alpha = 1 << 1,
+	Char_Digit = 1 << 2,
+	Char_Identifier = 1 << 3, // letters, digits and '_'
+	Char_Hex = 1 << 4,		  // digits and 'A' to 'F'
+};
+
+static const uint8_t char_classes[256] = {
+	['\t'] = Char_Space,
+	['\n'] = Char_Space,
+	['\v'] = Char_Space,
+	['\f'] = Char_Space,
+	['\r'] = Char_Space,
+	[' '] = Char_Space,
+	['_'] = Char_Identifier,
+	['0' ... '9'] = Char_Digit | Char_Identifier | Char_Hex,
+	['A' ... 'F'] = Char_Alpha | Char_Identifier | Char_Hex,
+	['G' ... 'Z'] = Char_Alpha | Char_Identifier,
+	['a' ... 'z'] = Char_Alpha | Char_Identifier,
+};
+
+static inline bool char_is(char c, enum char_class class) { return char_classes[(uint8_t)c] & class; }
+
+// 16 bytes at a time. a mask has `MASK_BITS` bits set for every byte that matched, in order.
+#if defined(__SSE2__)
+#define SCAN_VECTORS
+#define MASK_BITS 1
+#define MASK_ALL 0xffffull
+
+typedef __m128i bytes16;
+
+static inline bytes16 load16(const char *at) { return _mm_loadu_si128((const __m128i *)at); }
+static inline uint64_t equal16(bytes16 bytes, char c) {
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+}
+static inline uint64_t space16(bytes16 bytes) {
+	// '\t' to '\r' are 0 to 4 after the subtraction, everything else is larger as an unsigned byte.
+	__m128i control = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+	control = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8('\r' - '\t')), control);
+	return (uint32_t)_mm_movemask_epi8(_mm_or_si128(control, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '))));
+}
+#elif defined(__ARM_NEON)
+#define SCAN_VECTORS
+#define MASK_BITS 4
+#define MASK_ALL (~0ull)
+
+typedef uint8x16_t bytes16;
+
+// there is no movemask, narrowing every 16 bit lane by 4 leaves a nibble per byte.
+static inline uint64_t mask16(uint8x16_t matches) {
+	uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+static inline bytes16 load16(const char *at) { return vld1q_u8((const uint8_t *)at); }
+static inline uint64_t equal16(bytes16 bytes, char c) { return mask16(vceqq_u8(bytes, vdupq_n_u8((uint8_t)c))); }
+static inline uint64_t space16(bytes16 bytes) {
+	uint8x16_t control = vcleq_u8(vsubq_u8(bytes, vdupq_n_u8('\t')), vdupq_n_u8('\r' - '\t'));
+	return mask16(vorrq_u8(control, vceqq_u8(bytes, vdupq_n_u8(' '))));
+}
+#endif
+
+#ifdef SCAN_VECTORS
+static inline const char *first_match(const char *at, uint64_t mask) {
+	return at + __builtin_ctzll(mask) / MASK_BITS;
+}
+#endif
+
+static char *skip_whitespace(char *at, char *end) {
+#ifdef SCAN_VECTORS
+	// most runs are short, but one vector step covers them as well.
+	for (; end - at >= 16; at += 16) {
+		uint64_t other = ~space16(load16(at)) & MASK_ALL;
+		if (other)
+			return (char *)first_match(at, other);
 	}
-	++tokenizer->cursor;
-	++tokenizer->at;
+#endif
+	while (at < end && char_is(*at, Char_Space)) {
+		++at;
+	}
+	return at;
 }
 
-static void eat_whitespace(struct tokenizer *tokenizer) {
-	while (*tokenizer->at && isspace(*tokenizer->at)) {
-		advance(tokenizer);
+// the first `a` or `b` at or after `at`, `end` if there is none.
+static char *find_either(char *at, char *end, char a, char b) {
+#ifdef SCAN_VECTORS
+	for (; end - at >= 16; at += 16) {
+		bytes16 bytes = load16(at);
+		uint64_t found = equal16(bytes, a) | equal16(bytes, b);
+		if (found)
+			return (char *)first_match(at, found);
+	}
+#endif
+	while (at < end && *at != a && *at != b) {
+		++at;
 	}
+	return at;
 }
 
-static void eat_comment(struct tokenizer *tokenizer) {
-	while (*tokenizer->at && *tokenizer->at != '\n') {
-		advance(tokenizer);
+// whitespace and comments.
+static char *skip_trivia(char *at, char *end) {
+	at = skip_whitespace(at, end);
+	while (at < end && *at == '#') {
+		at = skip_whitespace(find_either(at, end, '\n', '\n'), end);
 	}
+	return at;
 }
 
-static void eat_command(struct tokenizer *tokenizer) {
-	while (*tokenizer->at && *tokenizer->at != '\n') {
-		if (*tokenizer->at == '\\') {
-			advance(tokenizer);
-		}
-		advance(tokenizer);
+// up to the end of the line. a backslash escapes the character after it, newlines included.
+static char *skip_command(char *at, char *end) {
+	for (;;) {
+		at = find_either(at, end, '\n', '\\');
+		if (at == end || *at == '\n')
+			return at;
+		at = end - at >= 2 ? at + 2 : end;
 	}
 }
 
-static void eat_hex(struct tokenizer *tokenizer) {
-	while ((*tokenizer->at) && ((isdigit(*tokenizer->at)) || (*tokenizer->at >= 'A' && *tokenizer->at <= 'F'))) {
-		advance(tokenizer);
+static char *skip_class(char *at, char *end, enum char_class class) {
+	while (at < end && char_is(*at, class)) {
+		++at;
 	}
+	return at;
 }
 
-static void eat_string(struct tokenizer *tokenizer) {
+static char *skip_string(char *at, char *end) {
 	/*
 	 * NOTE(koekeishiya): This is NOT proper string parsing code, as we do
 	 * not check for escaped '"' here. At the time of writing, this is only
@@ -60,49 +159,48 @@ static void eat_string(struct tokenizer *tokenizer) {
 	 * the most basic implementation that fulfills our current requirement.
 	 */
 
-	while (*tokenizer->at && *tokenizer->at != '"') {
-		advance(tokenizer);
-	}
+	return find_either(at, end, '"', '"');
 }
 
-static inline bool isidentifier_start(char c) { return isalpha(c) || c == '_'; }
-
-static void eat_identifier(struct tokenizer *tokenizer) {
-	if (isidentifier_start(*tokenizer->at)) {
-		advance(tokenizer);
+// the keyword `token` spells, as an index into the modifiers followed by the key literals. -1 if it is none.
+// one probe into the perfect hash generated by tools/keywords.c, which has to hash the same way.
+static int find_keyword(struct token token) {
+	const char *text = token.text;
+	unsigned slot = (token.length + keyword_values[(uint8_t)text[0]] + keyword_values[(uint8_t)text[1]] +
+					 keyword_values[(uint8_t)text[token.length - 1]]) &
+					(KEYWORD_SLOTS - 1);
+	int keyword = keyword_slots[slot] - 1;
+	if (keyword < 0) {
+		return -1;
 	}
 
-	while (isdigit(*tokenizer->at) || isidentifier_start(*tokenizer->at)) {
-		advance(tokenizer);
-	}
+	const char *name = keyword < array_count(modifier_flags_str)
+						   ? modifier_flags_str[keyword]
+						   : literal_keycode_str[keyword - array_count(modifier_flags_str)];
+	return strncmp(name, text, token.length) == 0 && name[token.length] == 0 ? keyword : -1;
 }
 
-static enum token_type resolve_identifier_type(struct token token) {
-	if (token.length == 1) {
-		return Token_Key;
-	}
-
-	for (int i = 0; i < array_count(modifier_flags_str); ++i) {
-		if (token_equals(token, modifier_flags_str[i])) {
-			return Token_Modifier;
-		}
+static void resolve_identifier_type(struct token *token) {
+	if (token->length == 1) {
+		token->type = Token_Key;
+		return;
 	}
 
-	for (int i = 0; i < array_count(literal_keycode_str); ++i) {
-		if (token_equals(token, literal_keycode_str[i])) {
-			return Token_Literal;
-		}
+	int keyword = find_keyword(*token);
+	if (keyword < 0) {
+		token->type = Token_Identifier;
+	} else if (keyword < array_count(modifier_flags_str)) {
+		token->type = Token_Modifier;
+		token->keyword = keyword;
+	} else {
+		token->type = Token_Literal;
+		token->keyword = keyword - array_count(modifier_flags_str);
 	}
-
-	return Token_Identifier;
 }
 
 static void do_special_identifier(struct tokenizer *tokenizer, struct token *t, enum token_type type) {
 	t->text = tokenizer->at;
-	t->line = tokenizer->line;
-	t->cursor = tokenizer->cursor;
-
-	eat_identifier(tokenizer);
+	tokenizer->at = skip_class(tokenizer->at, tokenizer->end, Char_Identifier);
 	t->length = tokenizer->at - t->text;
 	t->type = type;
 }
@@ -111,21 +209,21 @@ struct token peek_token(struct tokenizer *tokenizer) { return get_token(tokenize
 
 struct token get_token(struct tokenizer *tokenizer) {
 	struct token token;
-	char c;
+	char *end = tokenizer->end;
 
-	eat_whitespace(tokenizer);
+	tokenizer->at = skip_trivia(tokenizer->at, end);
 
 	token.length = 1;
+	token.keyword = 0;
 	token.text = tokenizer->at;
-	token.line = tokenizer->line;
-	token.cursor = tokenizer->cursor;
-	c = *token.text;
-	advance(tokenizer);
+	if (tokenizer->at == end) {
+		token.length = 0;
+		token.type = Token_EndOfStream;
+		return token;
+	}
+	char c = *tokenizer->at++;
 
 	switch (c) {
-	case '\0':
-		token.type = Token_EndOfStream;
-		break;
 	case '+': {
 		token.type = Token_Plus;
 	} break;
@@ -152,22 +250,16 @@ struct token get_token(struct tokenizer *tokenizer) {
 	} break;
 	case '"': {
 		token.text = tokenizer->at;
-		token.line = tokenizer->line;
-		token.cursor = tokenizer->cursor;
-
-		eat_string(tokenizer);
+		tokenizer->at = skip_string(tokenizer->at, end);
 		token.length = tokenizer->at - token.text;
 		token.type = Token_String;
 
-		advance(tokenizer);
-	} break;
-	case '#': {
-		eat_comment(tokenizer);
-		token = get_token(tokenizer);
+		if (tokenizer->at < end)
+			++tokenizer->at;
 	} break;
 	case '-': {
-		if (*tokenizer->at == '>') {
-			advance(tokenizer);
+		if (tokenizer->at < end && *tokenizer->at == '>') {
+			++tokenizer->at;
 			token.length = tokenizer->at - token.text;
 			token.type = Token_Arrow;
 		} else {
@@ -175,13 +267,8 @@ struct token get_token(struct tokenizer *tokenizer) {
 		}
 	} break;
 	case ':': {
-		eat_whitespace(tokenizer);
-
-		token.text = tokenizer->at;
-		token.line = tokenizer->line;
-		token.cursor = tokenizer->cursor;
-
-		eat_command(tokenizer);
+		token.text = skip_whitespace(tokenizer->at, end);
+		tokenizer->at = skip_command(token.text, end);
 		token.length = tokenizer->at - token.text;
 		token.type = Token_Command;
 	} break;
@@ -199,17 +286,16 @@ struct token get_token(struct tokenizer *tokenizer) {
 		do_special_identifier(tokenizer, &token, Token_Layer);
 	} break;
 	default: {
-		if (c == '0' && *tokenizer->at == 'x') {
-			advance(tokenizer);
-			eat_hex(tokenizer);
+		if (c == '0' && tokenizer->at < end && *tokenizer->at == 'x') {
+			tokenizer->at = skip_class(tokenizer->at + 1, end, Char_Hex);
 			token.length = tokenizer->at - token.text;
 			token.type = Token_Key_Hex;
-		} else if (isdigit(c)) {
+		} else if (char_is(c, Char_Digit)) {
 			token.type = Token_Key;
-		} else if (isalpha(c)) {
-			eat_identifier(tokenizer);
+		} else if (char_is(c, Char_Alpha)) {
+			tokenizer->at = skip_class(tokenizer->at, end, Char_Identifier);
 			token.length = tokenizer->at - token.text;
-			token.type = resolve_identifier_type(token);
+			resolve_identifier_type(&token);
 		} else {
 			token.type = Token_Unknown;
 		}
@@ -219,9 +305,29 @@ struct token get_token(struct tokenizer *tokenizer) {
 	return token;
 }
 
-void tokenizer_init(struct tokenizer *tokenizer, char *buffer) {
+struct token_position tokenizer_position(struct tokenizer *tokenizer, struct token token) {
+	char *at = token.text;
+	if (at < tokenizer->scanned) {
+		tokenizer->scanned = tokenizer->buffer;
+		tokenizer->scanned_line_start = tokenizer->buffer;
+		tokenizer->scanned_line = 1;
+	}
+
+	for (char *newline; (newline = memchr(tokenizer->scanned, '\n', at - tokenizer->scanned));) {
+		tokenizer->scanned = newline + 1;
+		tokenizer->scanned_line_start = newline + 1;
+		++tokenizer->scanned_line;
+	}
+	tokenizer->scanned = at;
+
+	return (struct token_position){.line = tokenizer->scanned_line, .cursor = at - tokenizer->scanned_line_start + 1};
+}
+
+void tokenizer_init(struct tokenizer *tokenizer, char *buffer, size_t length) {
 	tokenizer->buffer = buffer;
 	tokenizer->at = buffer;
-	tokenizer->line = 1;
-	tokenizer->cursor = 1;
+	tokenizer->end = buffer + length;
+	tokenizer->scanned = buffer;
+	tokenizer->scanned_line_start = buffer;
+	tokenizer->scanned_line = 1;
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 static const char *modifier_flags_str[] = {
 	"alt", "lalt", "ralt", "shift", "lshift", "rshift", "cmd", "lcmd", "rcmd", "ctrl", "lctrl", "rctrl", "fn", "nx",
 };
@@ -89,7 +91,11 @@ struct token {
 	enum token_type type;
 	char *text;
 	unsigned length;
+	unsigned keyword; // Token_Modifier: index into `modifier_flags_str`, Token_Literal: into `literal_keycode_str`
+};
 
+// where a token is in the buffer, both 1 based. tokens only carry their offset, see `tokenizer_position()`.
+struct token_position {
 	unsigned line;
 	unsigned cursor;
 };
@@ -97,11 +103,16 @@ struct token {
 struct tokenizer {
 	char *buffer;
 	char *at;
-	unsigned line;
-	unsigned cursor;
+	char *end;
+	// how far `tokenizer_position()` has counted lines, so positions asked for in order are resolved in one pass.
+	char *scanned;
+	char *scanned_line_start;
+	unsigned scanned_line;
 };
 
-void tokenizer_init(struct tokenizer *tokenizer, char *buffer);
+void tokenizer_init(struct tokenizer *tokenizer, char *buffer, size_t length);
 struct token get_token(struct tokenizer *tokenizer);
 struct token peek_token(struct tokenizer *tokenizer);
 int token_equals(struct token token, const char *match);
+// line and column of `token`. counts the lines up to it, so it is meant for error and debug output.
+struct token_position tokenizer_position(struct tokenizer *tokenizer, struct token token);
@@ -2,51 +2,287 @@
 
 #include "log.h"
 
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define MAX_TRACKED_OBJECTS 16384
+// backing block of a region context. objects are bump-allocated from `data`.
+struct region_chunk {
+	struct region_chunk *next;
+	int size;
+	int used;
+	char data[]; // 16-byte aligned, the header above is 16 bytes
+};
+
+#define REGION_CHUNK_SIZE (64 * 1024 - sizeof(struct region_chunk))
+// objects bigger than this get a chunk of their own, so they don't waste the rest of a shared chunk.
+#define REGION_LARGE_OBJECT (REGION_CHUNK_SIZE / 4)
+
+// size classes of pooled objects. every class has its own chunks, so objects of one kind (hotkeys, actions, ...) end
+// up next to each other. all classes are multiples of 16 to keep objects aligned.
+static const int pool_class_size[] = {16, 32, 48, 64, 96, 128};
+#define POOL_CLASSES (sizeof(pool_class_size) / sizeof(*pool_class_size))
+#define POOL_CHUNK_SIZE (16 * 1024 - sizeof(struct region_chunk))
 
 struct trctx {
-	void *slots[MAX_TRACKED_OBJECTS];
+	const char *name;
+	struct trctx *next; // all live contexts, see trctx_iter()
+	struct trctx *parent;
+	struct trctx *children; // linked through `sibling`
+	struct trctx *sibling;
+	bool region;
+	unsigned long allocations;			// malloc/realloc calls made in this context
+	unsigned long allocations_at_reset; // value of `allocations` at the last trctx_free_everything()
+	long live_bytes;
+	long peak_bytes;
+	int live_objects;
+	int tag_count;
+	struct trctx_tag_stats tags[TRCTX_MAX_TAGS]; // tags[0] collects untagged allocations
+	struct region_chunk *pools[POOL_CLASSES]; // current chunk first
+	// region mode
+	struct region_chunk *chunks; // current chunk first
+	// tracked mode
+	void **slots; // grows on demand, a context that never allocates doesn't have one
+	int slot_capacity;
 	int tracked_cnt;
 };
 
 struct tracked_mem_header {
 	struct trctx *ctx;
-	void **slot_ref;
+	uint32_t size;
+	uint32_t slot : 27; // tracked mode, index into ctx->slots
+	uint32_t tag : 5;	// index into ctx->tags
 };
 
 #define HDR_OFFSET (sizeof(struct tracked_mem_header))
 #define PTR_HDR(ptr) ((struct tracked_mem_header *)(ptr))
+#define REGION_ALIGN(sz) (((sz) + 15) & ~(size_t)15)
+#define MAX_TRACKED_SLOTS (1 << 27)
 
-struct trctx *trctx_new_context() {
+static __thread unsigned long total_allocations;
+static struct trctx *all_contexts;
+static pthread_mutex_t all_contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct trctx *trctx_new_context(const char *name) {
 	struct trctx *ctx = malloc(sizeof(struct trctx));
 	memset(ctx, 0, sizeof(struct trctx));
+	ctx->name = name;
+	ctx->tags[0].name = "other";
+	ctx->tag_count = 1;
+	pthread_mutex_lock(&all_contexts_lock);
+	ctx->next = all_contexts;
+	all_contexts = ctx;
+	pthread_mutex_unlock(&all_contexts_lock);
+	return ctx;
+}
+
+struct trctx *trctx_new_region(const char *name) {
+	struct trctx *ctx = trctx_new_context(name);
+	ctx->region = true;
 	return ctx;
 }
 
+static void free_chunks(struct region_chunk *chunk) {
+	for (struct region_chunk *next; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+}
+
+// marks all chunks as empty, keeping those of `keep_size` bytes around and freeing the rest.
+static void reset_chunks(struct region_chunk **link, int keep_size) {
+	while (*link) {
+		struct region_chunk *chunk = *link;
+		if (chunk->size != keep_size) {
+			*link = chunk->next;
+			free(chunk);
+		} else {
+			chunk->used = 0;
+			link = &chunk->next;
+		}
+	}
+}
+
+static long chunks_size(struct region_chunk *chunk) {
+	long size = 0;
+	for (; chunk; chunk = chunk->next)
+		size += sizeof(struct region_chunk) + chunk->size;
+	return size;
+}
+
+void trctx_set_parent(struct trctx *ctx, struct trctx *parent) {
+	if (ctx->parent) {
+		for (struct trctx **link = &ctx->parent->children; *link; link = &(*link)->sibling) {
+			if (*link == ctx) {
+				*link = ctx->sibling;
+				break;
+			}
+		}
+	}
+	ctx->parent = parent;
+	ctx->sibling = NULL;
+	if (parent) {
+		ctx->sibling = parent->children;
+		parent->children = ctx;
+	}
+}
+
 void trctx_destroy_context(struct trctx *ctx) {
+	while (ctx->children)
+		trctx_destroy_context(ctx->children);
+	trctx_set_parent(ctx, NULL);
+	pthread_mutex_lock(&all_contexts_lock);
+	for (struct trctx **link = &all_contexts; *link; link = &(*link)->next) {
+		if (*link == ctx) {
+			*link = ctx->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&all_contexts_lock);
 	trctx_free_everything(ctx);
+	free_chunks(ctx->chunks);
+	for (int i = 0; i < POOL_CLASSES; ++i)
+		free_chunks(ctx->pools[i]);
+	free(ctx->slots);
 	free(ctx);
 }
 
-void *trctx_malloc(struct trctx *ctx, int sz) {
+// tags are usually string literals, so try the pointer before comparing the text.
+static int find_tag(struct trctx *ctx, const char *tag) {
+	if (tag == NULL)
+		return 0;
+	for (int i = 1; i < ctx->tag_count; ++i) {
+		if (ctx->tags[i].name == tag || strcmp(ctx->tags[i].name, tag) == 0)
+			return i;
+	}
+	if (ctx->tag_count == TRCTX_MAX_TAGS)
+		return 0;
+	ctx->tags[ctx->tag_count] = (struct trctx_tag_stats){.name = tag};
+	return ctx->tag_count++;
+}
+
+// bookkeeping for an object of `sz` bytes being added to (sz > 0) or removed from (sz < 0) the context.
+static inline void account(struct trctx *ctx, int tag, long sz, int objects) {
+	ctx->live_bytes += sz;
+	ctx->live_objects += objects;
+	ctx->tags[tag].live_bytes += sz;
+	ctx->tags[tag].live_objects += objects;
+	if (ctx->live_bytes > ctx->peak_bytes)
+		ctx->peak_bytes = ctx->live_bytes;
+}
+
+static inline void *init_header(struct trctx *ctx, void *ptr, int sz, const char *tag) {
+	PTR_HDR(ptr)->ctx = ctx;
+	PTR_HDR(ptr)->size = sz;
+	PTR_HDR(ptr)->slot = 0;
+	PTR_HDR(ptr)->tag = find_tag(ctx, tag);
+	account(ctx, PTR_HDR(ptr)->tag, sz, 1);
+	ctx->allocations++;
+	total_allocations++;
+	return ptr + HDR_OFFSET;
+}
+
+static struct region_chunk *region_new_chunk(int size) {
+	struct region_chunk *chunk = malloc(sizeof(struct region_chunk) + size);
+	if (!chunk)
+		error("mkhd: out of memory\n");
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+// returns the current chunk of `chunks` if it has `need` bytes left. otherwise moves an empty chunk kept by
+// trctx_free_everything() to the front, or gets a new one.
+static struct region_chunk *chunk_with_room(struct region_chunk **chunks, size_t need, int chunk_size) {
+	struct region_chunk *chunk = *chunks;
+	if (chunk && chunk->size - chunk->used >= need)
+		return chunk;
+
+	struct region_chunk **link = chunk ? &chunk->next : chunks;
+	while (*link && ((*link)->used != 0 || (*link)->size != chunk_size))
+		link = &(*link)->next;
+	if (*link) {
+		chunk = *link;
+		*link = chunk->next;
+	} else {
+		chunk = region_new_chunk(chunk_size);
+	}
+	chunk->next = *chunks;
+	*chunks = chunk;
+	return chunk;
+}
+
+static void *region_malloc(struct trctx *ctx, int sz, const char *tag) {
+	size_t need = REGION_ALIGN(sz + HDR_OFFSET);
+	struct region_chunk *chunk;
+	if (need > REGION_LARGE_OBJECT) {
+		// dedicated chunk, linked behind the current one so bump allocation carries on where it was.
+		chunk = region_new_chunk(need);
+		if (ctx->chunks) {
+			chunk->next = ctx->chunks->next;
+			ctx->chunks->next = chunk;
+		} else {
+			ctx->chunks = chunk;
+		}
+	} else {
+		chunk = chunk_with_room(&ctx->chunks, need, REGION_CHUNK_SIZE);
+	}
+
+	void *ptr = chunk->data + chunk->used;
+	chunk->used += need;
+	return init_header(ctx, ptr, sz, tag);
+}
+
+// true if `ptr` (header included) is the most recent allocation in the current chunk.
+static inline bool region_is_last(struct trctx *ctx, void *ptr) {
+	struct region_chunk *chunk = ctx->chunks;
+	return chunk && (char *)ptr + REGION_ALIGN(PTR_HDR(ptr)->size + HDR_OFFSET) == chunk->data + chunk->used;
+}
+
+void *trctx_malloc_tagged(struct trctx *ctx, int sz, const char *tag) {
 	if (sz == 0)
 		return NULL;
+	if (ctx->region)
+		return region_malloc(ctx, sz, tag);
 	void *ptr = malloc(sz + HDR_OFFSET);
 
-	ctx->tracked_cnt++;
-	if (ctx->tracked_cnt > MAX_TRACKED_OBJECTS) {
-		error("mkhd: too many objects allocated within memory context (max %d)\n"
-			  "mkhd: this might indicate a config that is too large.\n"
-			  "mkhd: if this is not the case, please file a bug report!\n",
-			  MAX_TRACKED_OBJECTS);
+	if (ctx->tracked_cnt == ctx->slot_capacity) {
+		// objects refer to their slot by index, so the slot array can move freely.
+		if (ctx->slot_capacity == MAX_TRACKED_SLOTS)
+			error("mkhd: too many objects allocated within memory context (max %d)\n", MAX_TRACKED_SLOTS);
+		ctx->slot_capacity = ctx->slot_capacity ? ctx->slot_capacity * 2 : 256;
+		ctx->slots = realloc(ctx->slots, ctx->slot_capacity * sizeof(void *));
+		if (!ctx->slots)
+			error("mkhd: out of memory\n");
 	}
-	ctx->slots[ctx->tracked_cnt - 1] = ptr;
-	PTR_HDR(ptr)->ctx = ctx;
-	PTR_HDR(ptr)->slot_ref = &ctx->slots[ctx->tracked_cnt - 1];
+	ctx->slots[ctx->tracked_cnt] = ptr;
+	ptr = init_header(ctx, ptr, sz, tag);
+	PTR_HDR(ptr - HDR_OFFSET)->slot = ctx->tracked_cnt;
+	ctx->tracked_cnt++;
 
-	return ptr + HDR_OFFSET;
+	return ptr;
+}
+
+void *trctx_malloc(struct trctx *ctx, int sz) { return trctx_malloc_tagged(ctx, sz, NULL); }
+
+void *trctx_pool_alloc(struct trctx *ctx, int sz, const char *tag) {
+	int class = 0;
+	while (class < POOL_CLASSES && pool_class_size[class] < sz)
+		class++;
+	if (sz == 0 || class == POOL_CLASSES)
+		return trctx_malloc_tagged(ctx, sz, tag);
+
+	int size = pool_class_size[class];
+	struct region_chunk *chunk = chunk_with_room(&ctx->pools[class], size, POOL_CHUNK_SIZE);
+	void *ptr = chunk->data + chunk->used;
+	chunk->used += size;
+
+	account(ctx, find_tag(ctx, tag), size, 1);
+	ctx->allocations++;
+	total_allocations++;
+	return ptr;
 }
 
 void trctx_free(void *ptr) {
@@ -55,7 +291,16 @@ void trctx_free(void *ptr) {
 	// set the slot it takes to NULL
 	// the slot still can't be used to hold new object unless trctx_reclaim_empty_slots() is called
 	ptr = ptr - HDR_OFFSET;
-	*PTR_HDR(ptr)->slot_ref = NULL;
+	struct trctx *ctx = PTR_HDR(ptr)->ctx;
+	account(ctx, PTR_HDR(ptr)->tag, -(long)PTR_HDR(ptr)->size, -1);
+	if (ctx->region) {
+		// region objects are only really freed by trctx_free_everything(), except for the most recent one, which
+		// can simply be rolled back.
+		if (region_is_last(ctx, ptr))
+			ctx->chunks->used = (char *)ptr - ctx->chunks->data;
+		return;
+	}
+	ctx->slots[PTR_HDR(ptr)->slot] = NULL;
 	// keep ctx->tracked_cnt unchanged.
 	free(ptr);
 }
@@ -67,19 +312,67 @@ void *trctx_realloc(struct trctx *ctx, void *ptr, int sz) {
 	if (PTR_HDR(ptr)->ctx != ctx) {
 		error("mkhd: trctx_realloc: try to realloc object from another memory context\n");
 	}
+	int tag = PTR_HDR(ptr)->tag;
+	long old_size = PTR_HDR(ptr)->size;
+	if (ctx->region) {
+		struct region_chunk *chunk = ctx->chunks;
+		size_t need = REGION_ALIGN(sz + HDR_OFFSET);
+		if (region_is_last(ctx, ptr) && (char *)ptr + need <= chunk->data + chunk->size) {
+			// grow (or shrink) in place
+			chunk->used = (char *)ptr - chunk->data + need;
+			PTR_HDR(ptr)->size = sz;
+			account(ctx, tag, sz - old_size, 0);
+			ctx->allocations++;
+			total_allocations++;
+			return ptr + HDR_OFFSET;
+		}
+		// the old copy is dead, its memory goes with the next trctx_free_everything()
+		account(ctx, tag, -old_size, -1);
+		void *new_ptr = region_malloc(ctx, sz, ctx->tags[tag].name);
+		memcpy(new_ptr, ptr + HDR_OFFSET, old_size < sz ? old_size : sz);
+		return new_ptr;
+	}
 	ptr = realloc(ptr, sz + HDR_OFFSET);
-	*PTR_HDR(ptr)->slot_ref = ptr;
+	ctx->slots[PTR_HDR(ptr)->slot] = ptr;
+	PTR_HDR(ptr)->size = sz;
+	account(ctx, tag, sz - old_size, 0);
+	ctx->allocations++;
+	total_allocations++;
 
 	return ptr + HDR_OFFSET;
 }
 
+void *trctx_realloc_tagged(struct trctx *ctx, void *ptr, int sz, const char *tag) {
+	if (ptr == NULL)
+		return trctx_malloc_tagged(ctx, sz, tag);
+	return trctx_realloc(ctx, ptr, sz);
+}
+
 int trctx_free_everything(struct trctx *ctx) {
-	int freed_objects = 0;
+	// nothing was allocated since the last reset, so there is nothing to free. (the common case for memctx_event)
+	if (ctx->allocations == ctx->allocations_at_reset)
+		return 0;
+	ctx->allocations_at_reset = ctx->allocations;
+
+	int freed_objects = ctx->live_objects;
+	ctx->live_bytes = 0;
+	ctx->live_objects = 0;
+	for (int i = 0; i < ctx->tag_count; ++i) {
+		ctx->tags[i].live_bytes = 0;
+		ctx->tags[i].live_objects = 0;
+	}
+
+	// keep regular chunks around for the next round of allocations, only drop the dedicated large ones.
+	for (int i = 0; i < POOL_CLASSES; ++i)
+		reset_chunks(&ctx->pools[i], POOL_CHUNK_SIZE);
+	if (ctx->region) {
+		reset_chunks(&ctx->chunks, REGION_CHUNK_SIZE);
+		return freed_objects;
+	}
 	for (int i = 0; i < ctx->tracked_cnt; i++) {
 		if (ctx->slots[i] == NULL)
 			continue;
 		free(ctx->slots[i]);
-		freed_objects++;
 		ctx->slots[i] = NULL;
 	}
 	ctx->tracked_cnt = 0;
@@ -88,13 +381,15 @@ int trctx_free_everything(struct trctx *ctx) {
 
 // removes NULL entries in ctx->slots
 int trctx_reclaim_empty_slots(struct trctx *ctx) {
+	if (ctx->region)
+		return ctx->live_objects; // nothing to reclaim, freed objects don't take slots
 	int new_tracked_cnt = 0;
 	for (int i = 0; i < ctx->tracked_cnt; i++) {
 		if (ctx->slots[i] == NULL)
 			continue;
 		new_tracked_cnt++;
 		void *ptr = ctx->slots[new_tracked_cnt - 1] = ctx->slots[i];
-		PTR_HDR(ptr)->slot_ref = &ctx->slots[new_tracked_cnt - 1];
+		PTR_HDR(ptr)->slot = new_tracked_cnt - 1;
 
 		if (new_tracked_cnt - 1 != i) {
 			ctx->slots[i] = NULL;
@@ -104,11 +399,62 @@ int trctx_reclaim_empty_slots(struct trctx *ctx) {
 	return new_tracked_cnt;
 }
 
-struct trctx *trctx_g_ctx = NULL;
+static bool chunks_contain(struct region_chunk *chunk, const char *ptr) {
+	for (; chunk; chunk = chunk->next) {
+		if (ptr >= chunk->data && ptr < chunk->data + chunk->used)
+			return true;
+	}
+	return false;
+}
+
+bool trctx_contains(struct trctx *ctx, const void *ptr) {
+	for (int i = 0; i < POOL_CLASSES; ++i) {
+		if (chunks_contain(ctx->pools[i], ptr))
+			return true;
+	}
+	if (chunks_contain(ctx->chunks, ptr))
+		return true;
+	for (struct trctx *child = ctx->children; child; child = child->sibling) {
+		if (trctx_contains(child, ptr))
+			return true;
+	}
+	return false;
+}
+
+unsigned long trctx_allocation_count(struct trctx *ctx) { return ctx->allocations; }
+unsigned long trctx_total_allocation_count() { return total_allocations; }
+
+struct trctx *trctx_iter(struct trctx *ctx) { return ctx ? ctx->next : all_contexts; }
+
+void trctx_stats(struct trctx *ctx, struct trctx_stats *stats) {
+	stats->name = ctx->name;
+	stats->region = ctx->region;
+	stats->live_bytes = ctx->live_bytes;
+	stats->peak_bytes = ctx->peak_bytes;
+	stats->live_objects = ctx->live_objects;
+	stats->allocations = ctx->allocations;
+	stats->reserved_bytes = 0;
+	for (int i = 0; i < POOL_CLASSES; ++i)
+		stats->reserved_bytes += chunks_size(ctx->pools[i]);
+	if (ctx->region) {
+		stats->reserved_bytes += chunks_size(ctx->chunks);
+	} else {
+		// pooled objects are already covered above, count the tracked ones only.
+		for (int i = 0; i < ctx->tracked_cnt; ++i) {
+			if (ctx->slots[i])
+				stats->reserved_bytes += PTR_HDR(ctx->slots[i])->size + HDR_OFFSET;
+		}
+		stats->reserved_bytes += ctx->slot_capacity * sizeof(void *);
+	}
+	stats->tag_count = ctx->tag_count;
+	memcpy(stats->tags, ctx->tags, sizeof(struct trctx_tag_stats) * ctx->tag_count);
+}
+
+__thread struct trctx *trctx_g_ctx = NULL;
 
 // returns the original context
 struct trctx *trctx_set_memcontext(struct trctx *ctx) {
 	struct trctx *old = trctx_g_ctx;
 	trctx_g_ctx = ctx;
 	return old;
-}
\ No newline at end of file
+}
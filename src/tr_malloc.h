@@ -7,20 +7,83 @@
 // this frees us from the hassle of manually managing and freeing memories (hotkeys, actions, command strings, etc) on
 // config reload.
 // everything is supposed to be all freed on (and only on) config reload anyway.
+//
+// a context created with `trctx_new_region()` bump-allocates its objects from a few big chunks instead of calling
+// malloc for each of them. `trctx_free()` on a region object only gives memory back if it was the most recent
+// allocation, everything else is released at once by `trctx_free_everything()`, which just resets the chunks.
+// use it for contexts that are thrown away as a whole (config state, per-event scratch).
+//
+// a context can be made the child of another one, for objects that belong to the parent but outlive some of its
+// resets (eg. cached parts of the config). `trctx_free_everything()` leaves the children alone, destroying the parent
+// destroys them too.
+//
+// a context must only be used by one thread at a time. the current context (`trctx_g_ctx`) is per thread, so a
+// worker thread sets its own and doesn't disturb the main thread's.
+
+#include <stdbool.h>
 
 struct trctx;
 
-struct trctx *trctx_new_context();
+#define TRCTX_MAX_TAGS 16
+
+// allocations can carry a tag (a short string literal naming what they are, "hotkeys", "strings", ...). live memory
+// is broken down by tag in `struct trctx_stats`. untagged allocations are counted as "other".
+struct trctx_tag_stats {
+	const char *name;
+	long live_bytes;
+	int live_objects;
+};
+
+struct trctx_stats {
+	const char *name;
+	bool region;
+	long live_bytes;	 // bytes requested by live objects
+	long peak_bytes;	 // highest live_bytes since the context was created
+	long reserved_bytes; // bytes actually held from malloc, including headers and (region) unused chunk space
+	int live_objects;
+	unsigned long allocations; // malloc/realloc calls since the context was created
+	int tag_count;
+	struct trctx_tag_stats tags[TRCTX_MAX_TAGS];
+};
+
+// `name` identifies the context in stats output.
+struct trctx *trctx_new_context(const char *name);
+struct trctx *trctx_new_region(const char *name);
 void trctx_destroy_context(struct trctx *ctx);
+// `parent` may be NULL to detach `ctx` from its current parent.
+void trctx_set_parent(struct trctx *ctx, struct trctx *parent);
 
 void *trctx_malloc(struct trctx *ctx, int sz);
 void trctx_free(void *ptr);
 void *trctx_realloc(struct trctx *ctx, void *ptr, int sz);
+// `tag` is only used if `ptr` is NULL, an object keeps its tag when reallocated.
+void *trctx_malloc_tagged(struct trctx *ctx, int sz, const char *tag);
+void *trctx_realloc_tagged(struct trctx *ctx, void *ptr, int sz, const char *tag);
+
+// pooled allocation for small objects that live exactly as long as their context (hotkeys, actions, keyevents, short
+// strings). they are packed densely into per-size-class chunks without a per-object header, so they can't be passed to
+// `trctx_free()` or `trctx_realloc()` and are only released by `trctx_free_everything()`.
+// sizes above the largest class (128 bytes) fall back to a regular allocation, which must not be freed either.
+void *trctx_pool_alloc(struct trctx *ctx, int sz, const char *tag);
 
 int trctx_free_everything(struct trctx *ctx);
 int trctx_reclaim_empty_slots(struct trctx *ctx);
 
-extern struct trctx *trctx_g_ctx; // global context. use `trctx_set_memcontext()` to set.
+// true if `ptr` points into an object handed out by `ctx` or one of its children. only knows about region and pooled
+// objects.
+bool trctx_contains(struct trctx *ctx, const void *ptr);
+
+// number of allocations (malloc and realloc calls) made within a context since it was created.
+unsigned long trctx_allocation_count(struct trctx *ctx);
+// same, summed over all contexts, but only counting the calling thread's allocations.
+unsigned long trctx_total_allocation_count();
+
+void trctx_stats(struct trctx *ctx, struct trctx_stats *stats);
+// iterates over all live contexts. returns the first one for NULL, and NULL after the last one.
+// not safe while another thread creates or destroys contexts.
+struct trctx *trctx_iter(struct trctx *ctx);
+
+extern __thread struct trctx *trctx_g_ctx; // current context of this thread. use `trctx_set_memcontext()` to set.
 
 // these are shorthand version of tracked mallocs that uses the global memory context.
 // set a global memory context before using these.
@@ -28,6 +91,9 @@ extern struct trctx *trctx_g_ctx; // global context. use `trctx_set_memcontext()
 #define tr_malloc(sz) trctx_malloc(trctx_g_ctx, sz)
 #define tr_free(ptr) trctx_free(ptr)
 #define tr_realloc(ptr, sz) trctx_realloc(trctx_g_ctx, ptr, sz)
+#define tr_malloc_tag(sz, tag) trctx_malloc_tagged(trctx_g_ctx, sz, tag)
+#define tr_realloc_tag(ptr, sz, tag) trctx_realloc_tagged(trctx_g_ctx, ptr, sz, tag)
+#define tr_pool_alloc(sz, tag) trctx_pool_alloc(trctx_g_ctx, sz, tag)
 
 // returns the original context
 struct trctx *trctx_set_memcontext(struct trctx *ctx);
\ No newline at end of file
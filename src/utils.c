@@ -1,5 +1,6 @@
 #include "utils.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -12,7 +13,7 @@ bool same_string(const char *a, const char *b) {
 
 char *copy_string_malloc(const char *s) {
 	unsigned length = strlen(s);
-	char *result = (char *)tr_malloc(length + 1);
+	char *result = (char *)tr_malloc_tag(length + 1, "strings");
 
 	copy_string_count_nomalloc(result, s, length);
 
@@ -26,7 +27,13 @@ char *copy_string_count_nomalloc(char *dst, const char *s, int length) {
 }
 
 char *copy_string_count_malloc(const char *s, int length) {
-	char *result = tr_malloc(length + 1);
+	char *result = tr_malloc_tag(length + 1, "strings");
+	return copy_string_count_nomalloc(result, s, length);
+}
+
+// for strings that are never freed on their own (see `trctx_pool_alloc()`)
+char *copy_string_count_pooled(const char *s, int length) {
+	char *result = tr_pool_alloc(length + 1, "strings");
 	return copy_string_count_nomalloc(result, s, length);
 }
 
@@ -43,3 +50,13 @@ char *file_name(char *file) {
 	char *name = copy_string_malloc(last_slash + 1);
 	return name;
 }
+
+// FNV-1a, continuing from `hash`. (start with HASH_BYTES_SEED)
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t length) {
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
@@ -1,13 +1,19 @@
 #pragma once
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 bool same_string(const char *a, const char *b);
 char *copy_string_malloc(const char *s);
 char *file_directory(char *file);
 char *copy_string_count_nomalloc(char *dst, const char *s, int length);
 char *copy_string_count_malloc(const char *s, int length);
+char *copy_string_count_pooled(const char *s, int length);
 char *file_name(char *file);
 
+#define HASH_BYTES_SEED 0xcbf29ce484222325ULL
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t length);
+
 char *copy_string_tr(const char *s);
 char *copy_string_count_malloc(const char *s, int length);
 
@@ -0,0 +1,147 @@
+// lookup time and memory per entry of a mutable table against the same table frozen by `table_freeze()`, at 10 to
+// 10000 entries. (`make freeze-bench`)
+//
+// half of the queries are misses. "random" keys are spread over the whole key space, "keyevent" keys are what a config
+// binds: a few event types, common modifier combinations and the 128 keycodes. memory is what the table's own memory
+// context holds from malloc, headers included.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hashtable.h"
+#include "tr_malloc.h"
+
+bool verbose;
+bool veryverbose;
+
+#define QUERIES 4096
+#define ROUNDS 1000
+
+static void *volatile sink; // keeps the lookups from being optimized away
+
+struct key {
+	int type;
+	uint32_t flags;
+	uint32_t key;
+};
+
+static int compare_key(const struct key *a, const struct key *b) {
+	return a->type == b->type && a->flags == b->flags && a->key == b->key;
+}
+
+static unsigned long hash_key(const struct key *a) {
+	uint64_t h = ((uint64_t)a->type << 40) ^ ((uint64_t)a->flags << 20) ^ a->key;
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+static uint64_t random_state = 0x9e3779b97f4a7c15ull;
+static uint32_t next_random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return (uint32_t)random_state;
+}
+
+static struct key random_key(bool keyevent) {
+	if (!keyevent)
+		return (struct key){.key = next_random()};
+	static const uint32_t modifiers[] = {0, 1 << 0, 1 << 3, 1 << 6, 1 << 9, (1 << 0) | (1 << 3), (1 << 0) | (1 << 6)};
+	return (struct key){.type = next_random() % 3,
+						.flags = modifiers[next_random() % (sizeof(modifiers) / sizeof(*modifiers))] |
+								 (next_random() % 16) << 12,
+						.key = next_random() % 128};
+}
+
+static double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static long reserved_bytes(struct trctx *ctx) {
+	struct trctx_stats stats;
+	trctx_stats(ctx, &stats);
+	return stats.reserved_bytes;
+}
+
+static double lookup_time(struct table *table, struct key *queries) {
+	double start = now();
+	for (int round = 0; round < ROUNDS; ++round) {
+		for (int i = 0; i < QUERIES; ++i)
+			sink = table_find(table, &queries[i]);
+	}
+	return (now() - start) / ((double)ROUNDS * QUERIES);
+}
+
+static bool run(const char *name, bool keyevent, int count) {
+	struct trctx *mutable_ctx = trctx_new_context("mutable");
+	struct trctx *frozen_ctx = trctx_new_context("frozen");
+	long mutable_empty = reserved_bytes(mutable_ctx);
+	long frozen_empty = reserved_bytes(frozen_ctx);
+
+	// the keyevent space is small, duplicates are skipped so both tables hold `count` distinct keys.
+	struct key *keys = malloc(sizeof(struct key) * count);
+	struct table mutable, frozen;
+	trctx_set_memcontext(mutable_ctx);
+	table_init(&mutable, 8, (table_hash_func)hash_key, (table_compare_func)compare_key);
+	for (int i = 0; i < count;) {
+		keys[i] = random_key(keyevent);
+		if (!table_find(&mutable, &keys[i])) {
+			table_add(&mutable, &keys[i], &keys[i]);
+			++i;
+		}
+	}
+	trctx_set_memcontext(frozen_ctx);
+	table_init(&frozen, 8, (table_hash_func)hash_key, (table_compare_func)compare_key);
+	for (int i = 0; i < count; ++i)
+		table_add(&frozen, &keys[i], &keys[i]);
+	double start = now();
+	if (!table_freeze(&frozen)) {
+		fprintf(stderr, "freeze_bench: %s n=%d: no perfect hash found\n", name, count);
+		return false;
+	}
+	double freeze_time = now() - start;
+
+	struct key *queries = malloc(sizeof(struct key) * QUERIES);
+	for (int i = 0; i < QUERIES; ++i)
+		queries[i] = i % 2 ? keys[next_random() % count] : random_key(keyevent);
+	for (int i = 0; i < QUERIES; ++i) {
+		if (table_find(&mutable, &queries[i]) != table_find(&frozen, &queries[i])) {
+			fprintf(stderr, "freeze_bench: %s n=%d: the tables disagree on a lookup\n", name, count);
+			return false;
+		}
+	}
+
+	double mutable_time = lookup_time(&mutable, queries);
+	double frozen_time = lookup_time(&frozen, queries);
+	printf("  %-8s n=%-5d  %7.1f ns %6.1f B  | %7.1f ns %6.1f B  %8.2f ms\n", name, count, mutable_time,
+		   (double)(reserved_bytes(mutable_ctx) - mutable_empty) / count, frozen_time,
+		   (double)(reserved_bytes(frozen_ctx) - frozen_empty) / count, freeze_time / 1e6);
+
+	trctx_set_memcontext(NULL);
+	trctx_destroy_context(mutable_ctx);
+	trctx_destroy_context(frozen_ctx);
+	free(queries);
+	free(keys);
+	return true;
+}
+
+int main(void) {
+	static const int counts[] = {10, 100, 1000, 10000};
+	printf("                     mutable lookup/entry  |  frozen lookup/entry   freezing\n");
+	for (int kind = 0; kind < 2; ++kind) {
+		for (int i = 0; i < sizeof(counts) / sizeof(*counts); ++i) {
+			if (!run(kind ? "keyevent" : "random", kind, counts[i]))
+				return 1;
+		}
+	}
+	return 0;
+}
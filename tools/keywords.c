@@ -0,0 +1,134 @@
+// generates src/keywords.h, the perfect hash that resolves modifier and key literal identifiers. (`make keywords`)
+// run it again whenever `modifier_flags_str` or `literal_keycode_str` in src/tokenize.h change.
+//
+// the hash is gperf style, `length + values[first] + values[second] + values[last]` modulo a power of two, with
+// `values` searched for until every keyword lands in a slot of its own. the search is seeded, so the output only
+// changes when the keywords do.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tokenize.h"
+
+#define array_count(a) (sizeof((a)) / sizeof(*(a)))
+#define MAX_STEPS 1000000
+
+static const char *keywords[array_count(modifier_flags_str) + array_count(literal_keycode_str)];
+static int keyword_count;
+
+static uint8_t values[256];
+static uint8_t slots[256];
+
+static uint64_t random_state = 0x9e3779b97f4a7c15ull;
+static uint32_t next_random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return (uint32_t)random_state;
+}
+
+static unsigned keyword_hash(const char *keyword, unsigned size) {
+	size_t length = strlen(keyword);
+	return (length + values[(uint8_t)keyword[0]] + values[(uint8_t)keyword[1]] + values[(uint8_t)keyword[length - 1]]) &
+		   (size - 1);
+}
+
+static int count_collisions(unsigned size) {
+	int collisions = 0;
+	memset(slots, 0, sizeof(slots));
+	for (int i = 0; i < keyword_count; ++i) {
+		unsigned slot = keyword_hash(keywords[i], size);
+		if (slots[slot])
+			++collisions;
+		else
+			slots[slot] = i + 1;
+	}
+	return collisions;
+}
+
+// local search: change the value of a character of a keyword that has no slot of its own, keep the change unless it
+// makes things worse.
+static bool search_values(unsigned size) {
+	for (int i = 0; i < 256; ++i) {
+		values[i] = next_random() & (size - 1);
+	}
+
+	int collisions = count_collisions(size);
+	for (int step = 0; step < MAX_STEPS && collisions > 0; ++step) {
+		int keyword;
+		do {
+			keyword = next_random() % keyword_count;
+		} while (slots[keyword_hash(keywords[keyword], size)] == keyword + 1);
+
+		size_t length = strlen(keywords[keyword]);
+		size_t positions[] = {0, 1, length - 1};
+		uint8_t c = keywords[keyword][positions[next_random() % 3]];
+		uint8_t previous = values[c];
+		values[c] = next_random() & (size - 1);
+
+		int result = count_collisions(size);
+		if (result <= collisions) {
+			collisions = result;
+		} else {
+			values[c] = previous;
+			count_collisions(size);
+		}
+	}
+	return collisions == 0;
+}
+
+static void print_table(const char *type, const char *name, uint8_t *table, int count) {
+	printf("static const %s %s[%d] = {\n", type, name, count);
+	for (int i = 0; i < count; i += 16) {
+		printf("\t");
+		for (int j = i; j < i + 16 && j < count; ++j) {
+			printf("%3d,%s", table[j], j + 1 < i + 16 && j + 1 < count ? " " : "");
+		}
+		printf("\n");
+	}
+	printf("};\n");
+}
+
+int main(void) {
+	for (int i = 0; i < array_count(modifier_flags_str); ++i) {
+		keywords[keyword_count++] = modifier_flags_str[i];
+	}
+	for (int i = 0; i < array_count(literal_keycode_str); ++i) {
+		keywords[keyword_count++] = literal_keycode_str[i];
+	}
+
+	unsigned size = 64;
+	while (size < keyword_count)
+		size *= 2;
+	for (; !search_values(size); size *= 2) {
+		if (size == 256) {
+			fprintf(stderr, "keywords: no perfect hash found\n");
+			return 1;
+		}
+	}
+
+	// characters that are not in any keyword's hashed positions can have any value, keep the table readable.
+	bool used[256] = {false};
+	for (int i = 0; i < keyword_count; ++i) {
+		size_t length = strlen(keywords[i]);
+		used[(uint8_t)keywords[i][0]] = used[(uint8_t)keywords[i][1]] = used[(uint8_t)keywords[i][length - 1]] = true;
+	}
+	for (int i = 0; i < 256; ++i) {
+		if (!used[i])
+			values[i] = 0;
+	}
+
+	printf("#pragma once\n\n");
+	printf("// generated by tools/keywords.c (`make keywords`), do not edit.\n");
+	printf("// modifier and key literal identifiers, see `find_keyword()` in tokenize.c.\n\n");
+	printf("#include <stdint.h>\n\n");
+	printf("#define KEYWORD_SLOTS %u\n\n", size);
+	printf("// clang-format off\n");
+	print_table("uint8_t", "keyword_values", values, 256);
+	printf("\n// 1 + the keyword's index, modifiers first and then key literals. 0 for an empty slot.\n");
+	print_table("uint8_t", "keyword_slots", slots, size);
+	printf("// clang-format on\n");
+	return 0;
+}
@@ -0,0 +1,168 @@
+// lookup time and memory per entry of the flat open-addressing table in src/hashtable.c, against the chained table it
+// replaced (kept below as `chained_*`). (`make table-bench`)
+//
+// the keys are keyevent-shaped, every table starts out with the capacity the config tables used to have and is looked
+// up in a scrambled order. "zero-hash" hashes every key to 0, like hash_keyevent once did, which turns both tables into
+// a linear scan. memory is what the table's own memory context holds from malloc, headers included.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hashtable.h"
+#include "tr_malloc.h"
+
+bool verbose;
+bool veryverbose;
+
+#define INITIAL_CAPACITY 131
+#define LOOKUPS 4000000
+
+static void *volatile sink; // keeps the lookups from being optimized away
+
+struct key {
+	int type;
+	uint32_t flags;
+	uint32_t key;
+};
+
+static int compare_key(const struct key *a, const struct key *b) {
+	return a->type == b->type && a->flags == b->flags && a->key == b->key;
+}
+
+static unsigned long hash_zero(const struct key *a) { return 0; }
+
+static unsigned long hash_mixed(const struct key *a) {
+	uint64_t h = ((uint64_t)a->type << 40) ^ ((uint64_t)a->flags << 20) ^ a->key;
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+// the chained table as it was: one allocated bucket per entry, a fixed number of chains.
+struct chained_bucket {
+	const void *key;
+	void *value;
+	struct chained_bucket *next;
+};
+
+struct chained_table {
+	int capacity;
+	table_hash_func hash;
+	table_compare_func compare;
+	struct chained_bucket **buckets;
+};
+
+static void chained_init(struct chained_table *table, int capacity, table_hash_func hash, table_compare_func compare) {
+	table->capacity = capacity;
+	table->hash = hash;
+	table->compare = compare;
+	table->buckets = tr_malloc(sizeof(struct chained_bucket *) * capacity);
+	for (int i = 0; i < capacity; ++i)
+		table->buckets[i] = NULL;
+}
+
+static struct chained_bucket **chained_get_bucket(struct chained_table *table, const void *key) {
+	struct chained_bucket **bucket = table->buckets + (table->hash(key) % table->capacity);
+	while (*bucket) {
+		if (table->compare((*bucket)->key, key))
+			break;
+		bucket = &(*bucket)->next;
+	}
+	return bucket;
+}
+
+static void chained_add(struct chained_table *table, const void *key, void *value) {
+	struct chained_bucket **bucket = chained_get_bucket(table, key);
+	if (!*bucket) {
+		*bucket = tr_malloc(sizeof(struct chained_bucket));
+		**bucket = (struct chained_bucket){.key = key, .value = value};
+	}
+}
+
+static void *chained_find(struct chained_table *table, const void *key) {
+	struct chained_bucket *bucket = *chained_get_bucket(table, key);
+	return bucket ? bucket->value : NULL;
+}
+
+static double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static long reserved_bytes(struct trctx *ctx) {
+	struct trctx_stats stats;
+	trctx_stats(ctx, &stats);
+	return stats.reserved_bytes;
+}
+
+static bool run(const char *name, table_hash_func hash, int count) {
+	struct key *keys = malloc(sizeof(struct key) * count);
+	for (int i = 0; i < count; ++i)
+		keys[i] = (struct key){.type = 1, .flags = (i / 128) << 3, .key = i % 128};
+	// a linear scan per lookup is slow, fewer of them still give a stable number.
+	int lookups = hash == (table_hash_func)hash_zero ? LOOKUPS / count : LOOKUPS;
+
+	struct trctx *flat_ctx = trctx_new_context("flat");
+	struct trctx *chained_ctx = trctx_new_context("chained");
+	long flat_empty = reserved_bytes(flat_ctx);
+	long chained_empty = reserved_bytes(chained_ctx);
+
+	struct table flat;
+	trctx_set_memcontext(flat_ctx);
+	table_init(&flat, INITIAL_CAPACITY, hash, (table_compare_func)compare_key);
+	for (int i = 0; i < count; ++i)
+		table_add(&flat, &keys[i], &keys[i]);
+
+	struct chained_table chained;
+	trctx_set_memcontext(chained_ctx);
+	chained_init(&chained, INITIAL_CAPACITY, hash, (table_compare_func)compare_key);
+	for (int i = 0; i < count; ++i)
+		chained_add(&chained, &keys[i], &keys[i]);
+
+	for (int i = 0; i < count; ++i) {
+		if (table_find(&flat, &keys[i]) != &keys[i] || chained_find(&chained, &keys[i]) != &keys[i]) {
+			fprintf(stderr, "table_bench: %s n=%d: a lookup found the wrong entry\n", name, count);
+			return false;
+		}
+	}
+
+	double start = now();
+	for (int i = 0; i < lookups; ++i)
+		sink = table_find(&flat, &keys[(i * 7919u) % count]);
+	double flat_time = now() - start;
+	start = now();
+	for (int i = 0; i < lookups; ++i)
+		sink = chained_find(&chained, &keys[(i * 7919u) % count]);
+	double chained_time = now() - start;
+
+	printf("  %-9s n=%-5d  %14.1f  %7.1f  | %17.1f  %7.1f\n", name, count, flat_time / lookups,
+		   (double)(reserved_bytes(flat_ctx) - flat_empty) / count, chained_time / lookups,
+		   (double)(reserved_bytes(chained_ctx) - chained_empty) / count);
+
+	trctx_set_memcontext(NULL);
+	trctx_destroy_context(flat_ctx);
+	trctx_destroy_context(chained_ctx);
+	free(keys);
+	return true;
+}
+
+int main(void) {
+	static const int counts[] = {8, 128, 512, 2000};
+	printf("                    flat ns/lookup  B/entry  | chained ns/lookup  B/entry\n");
+	for (int i = 0; i < sizeof(counts) / sizeof(*counts); ++i) {
+		if (!run("zero-hash", (table_hash_func)hash_zero, counts[i]))
+			return 1;
+	}
+	for (int i = 0; i < sizeof(counts) / sizeof(*counts); ++i) {
+		if (!run("mixed", (table_hash_func)hash_mixed, counts[i]))
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,129 @@
+// tokenizer throughput in MB/s. (`make tokenize-bench`)
+//
+// without arguments it tokenizes a generated config of about 3.5 MB: bindings with modifiers and layers, long commands
+// continued over several lines, and comments. config files given as arguments are tokenized instead.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tokenize.h"
+
+#define GENERATED_LINES 60000
+#define MIN_SECONDS 0.5
+
+static uint64_t random_state = 0x9e3779b97f4a7c15ull;
+static uint32_t next_random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return (uint32_t)random_state;
+}
+
+#define pick(array) (array)[next_random() % (sizeof(array) / sizeof(*(array)))]
+
+static char *generate_config(size_t *length) {
+	static const char *modifiers[] = {"cmd", "alt", "ctrl", "shift", "lalt", "rcmd", "cmd + alt", "ctrl + alt",
+									  "shift + lalt", "lalt + cmd + rcmd", "fn"};
+	static const char *keys[] = {"a", "z", "0", "5", "0x32", "return", "space", "f12", "left", "tab"};
+	static const char *comment = "comment text about the binding below ";
+
+	size_t capacity = GENERATED_LINES * 128;
+	char *text = malloc(capacity);
+	size_t size = 0;
+	for (int line = 0; line < GENERATED_LINES && size + 512 < capacity; ++line) {
+		int layer = next_random() % 4;
+		char prefix[8] = "";
+		if (layer < 3)
+			snprintf(prefix, sizeof(prefix), "|l%d ", layer);
+		switch (next_random() % 8) {
+		case 0:
+			size += sprintf(text + size, "# %s%s\n", comment, next_random() % 2 ? comment : "");
+			break;
+		case 1:
+			size += sprintf(text + size, "\n");
+			break;
+		case 2:
+		case 3:
+			size += sprintf(text + size,
+							"%s%s - %s :   open -a \"Application %d\" && echo done \\\n"
+							"    && yabai -m window --focus %s\n",
+							prefix, pick(modifiers), pick(keys), line, next_random() % 2 ? "west" : "east");
+			++line;
+			break;
+		default:
+			size += sprintf(text + size,
+							"%s%s - %s :   yabai -m space --focus %d; osascript -e 'display notification \"%d\"'\n",
+							prefix, pick(modifiers), pick(keys), line % 10, line);
+			break;
+		}
+	}
+	*length = size;
+	return text;
+}
+
+static char *read_config(const char *file, size_t *length) {
+	FILE *handle = fopen(file, "rb");
+	if (!handle)
+		return NULL;
+	char *text = NULL;
+	long size;
+	if (fseek(handle, 0, SEEK_END) == 0 && (size = ftell(handle)) >= 0 && fseek(handle, 0, SEEK_SET) == 0) {
+		text = malloc(size + 1);
+		if (fread(text, 1, size, handle) != size) {
+			free(text);
+			text = NULL;
+		}
+		*length = size;
+	}
+	fclose(handle);
+	return text;
+}
+
+static double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void run(const char *name, char *text, size_t length) {
+	struct tokenizer tokenizer;
+	long tokens = 0;
+	int passes = 0;
+	double start = now();
+	double elapsed;
+	do {
+		tokenizer_init(&tokenizer, text, length);
+		while (get_token(&tokenizer).type != Token_EndOfStream)
+			++tokens;
+		++passes;
+	} while ((elapsed = now() - start) < MIN_SECONDS);
+
+	printf("  %-32s %8.1f KB %9ld tokens %8.1f MB/s\n", name, length / 1024.0, tokens / passes,
+		   length * passes / elapsed / (1024 * 1024));
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		size_t length;
+		char *text = generate_config(&length);
+		run("generated config", text, length);
+		free(text);
+		return 0;
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		size_t length;
+		char *text = read_config(argv[i], &length);
+		if (!text) {
+			fprintf(stderr, "tokenize_bench: could not read '%s'\n", argv[i]);
+			return 1;
+		}
+		run(argv[i], text, length);
+		free(text);
+	}
+	return 0;
+}